@@ -41,11 +41,26 @@ extern unsigned g_bounce_every;
 extern int g_move_x;
 extern int g_move_y;
 extern int g_move_z;
+// whether to build a bounding volume hierarchy over the faces of the mesh
+extern bool g_use_bvh;
 
 extern int g_cube_size;
 extern int verbose;
 extern char senaddr[256];
 extern char i2c_bus[256];
 extern char object_file[256];
+// most meshes that can be given with --object-file
+#define ARG_MAX_OBJECTS 64
+// every file given with --object-file, the first one is also in `object_file`
+extern char object_files[ARG_MAX_OBJECTS][256];
+extern unsigned g_n_object_files;
+// most levels of detail to build for each object, 0 for none
+extern unsigned g_lod_levels;
+// objects are drawn in a grid of that many rows and columns, 0 for a single row
+extern unsigned g_grid_size;
+// frames to render in a benchmark without the sensor, 0 to follow the sensor
+extern unsigned g_bench_frames;
+// degrees the sensor must turn by since the last frame drawn to draw another one
+extern float g_dead_band;
 
 void arg_parse(int argc, char** argv);
@@ -2,9 +2,11 @@
 #define OBJECTS_H 
 
 #include "vector.h"
+#include "utils.h"
 #include <stdbool.h> // true/false
 #include <math.h> // round
 #include <stddef.h> // size_t
+#include <stdint.h> // int64_t
 
 enum connection_t {
     CONNECTION_RECT=0,
@@ -14,38 +16,200 @@ enum connection_t {
 
 typedef char color_t;
 
+// number of pixels the run tests `obj_ray_hits_*_run` check at once
+#if defined(__AVX2__)
+#define OBJ_RUN_LENGTH 8
+#else
+#define OBJ_RUN_LENGTH 4
+#endif
+
+// fractional bits of fixed-point depths
+#define OBJ_FIXED_BITS 16
+
+// matrices meshes are rotated with, in fixed point (see `VEC_FIXED_BITS`) in
+// integer-only builds
+#ifdef INTEGER_ONLY
+typedef mat4i_t rot_mat_t;
+#else
+typedef mat4_t rot_mat_t;
+#endif
+
+/*
+ * Edge function of the segment from p to q projected on the xy plane,
+ * e(x, y) = a*x + b*y + c, i.e. twice the signed area of (p, q, (x, y)). It's
+ * zero on the segment and its sign tells which side of it (x, y) is on. It
+ * changes by `a` from one pixel to the next along x and by `b` along y.
+ */
+typedef struct edge {
+    int a, b, c;
+} edge_t;
+
+/*
+ * Depth of a plane as a function of x and y in fixed point with
+ * `OBJ_FIXED_BITS` fractional bits, z(x, y) = z0 + dzdx*x + dzdy*y. It
+ * changes by `dzdx` from one pixel to the next along x and by `dzdy` along y.
+ */
+typedef struct plane_depth {
+    int64_t z0, dzdx, dzdy;
+} plane_depth_t;
+
+/*
+ * Per-frame data of a face (surface) of a mesh. It's computed once after the
+ * mesh is rotated or translated so that it doesn't have to be recomputed for
+ * every pixel that's tested against the face.
+ */
+typedef struct face {
+    // copies of the (transformed) vertices, the last one is unused for triangles
+    vec3i_t points[4];
+    // plane of the face, see `plane_t`
+    vec3i_t normal;
+    int offset;
+    // 1/normal.z, used to solve the plane's equation for z
+    double inv_normal_z;
+    // integer versions of the above - the edges of (p0, p1, p2) and, for
+    // rectangles, of (p0, p2, p3): p0p1, p1p2, p2p0, p2p3, p3p0
+    edge_t edges[5];
+    plane_depth_t depth;
+    // bounding rectangle of the face projected on the xy plane
+    int xmin, xmax;
+    int ymin, ymax;
+    // connection_t enum
+    int type;
+    color_t color;
+    // set by the renderer when the face points away from the camera
+    bool is_culled;
+    // set by the renderer to the color the face is drawn with in the current
+    // frame - `color` or, with reflectance, one that depends on its normal
+    color_t shade;
+} face_t;
+
+/*
+ * Surface of a mesh as it's defined in its file: the indexes of the vertices
+ * that span it, its connection type and the character it's painted with.
+ * To define a rectangular surface, use:
+ * {{3, 4, 6, 7}, CONNECTION_RECT, 'o'},
+ * For a triangular surface:
+ * {{3, 4, 6, 3}, CONNECTION_TRIANGLE, 'o'},
+ * The last index of a triangular surface is ignored. The generated surface
+ * will be spanned by vertices[3], [4], [6], [7] or [3], [4], [6] respectively
+ * and painted with the 'o' character.
+ */
+typedef struct connection {
+    uint32_t indexes[4];
+    // connection_t enum
+    uint8_t type;
+    color_t color;
+} conn_t;
+
+// rectangle of the xy plane, bounds included
+typedef struct rect {
+    int xmin, xmax;
+    int ymin, ymax;
+} rect_t;
+
+// most faces in a leaf of the bounding volume hierarchy of a mesh
+#define OBJ_BVH_LEAF_SIZE 4
+
+/*
+ * Node of the bounding volume hierarchy of a mesh. Rays are tested against
+ * faces at an (x, y) of the world so a node bounds the rectangles of its faces
+ * on the xy plane (see `face_t`). Nodes are stored depth first - the first
+ * child of an inner node comes right after it.
+ */
+typedef struct bvh_node {
+    rect_t rect;
+    // index of the second child for inner nodes, of the first face in
+    // `bvh_t.faces` for leaves
+    size_t index;
+    // number of faces of a leaf, 0 for inner nodes
+    size_t n_faces;
+    bool is_leaf;
+} bvh_node_t;
+
+typedef struct bvh {
+    bvh_node_t* nodes;
+    size_t n_nodes;
+    // indexes of the faces of the mesh, those of each leaf next to each other
+    size_t* faces;
+    // copies of the rectangles of `faces` so that looking them up doesn't
+    // touch the faces themselves
+    rect_t* rects;
+} bvh_t;
+
 typedef struct mesh {
-    vec3i_t** vertices;
-    vec3i_t** vertices_backup;
+    // vertices in world coordinates, one after the other - not up to date
+    // while `is_moved` is set, see `obj_mesh_pose`
+    vec3i_t* vertices;
+    // rest pose of the vertices, never modified once the mesh is loaded
+    vec3i_t* vertices_backup;
+    // translation of `vertices` from `vertices_backup`
+    vec3i_t offset;
+    // rotation of `vertices` about `center`, its translation is 0
+    rot_mat_t rotation;
     vec3i_t* center;
     // number of vertices
     size_t n_vertices;
     // number of surfaces
     size_t n_faces;
+    // smallest axis aligned box around the vertices, updated whenever they move,
+    // and one that's just large enough to hold them while `is_moved` is set
     struct bounding_box {
         // top left
         int x0, y0, z0;
         // bottop right
         int x1, y1, z1;
+        // size the mesh was loaded with
         unsigned width, height, depth;
     } bounding_box;
+    // smallest axis aligned box around `vertices_backup`
+    struct bounding_box rest_box;
+    // surfaces of the solid, one after the other and grouped by connection
+    // type so that faces of the same type are visited together
+    conn_t* connections;
+    /*
+     * Instances (see `obj_mesh_instance_new`) share `vertices_backup` and
+     * `connections` with the mesh they were made from, its prototype, and
+     * only own the data that changes when they move. NULL for meshes that own
+     * all of their data.
+     */
+    const struct mesh* prototype;
+    // color of all faces, overrides the colors of `connections` unless it's 0
+    color_t color;
+    // one entry per connection, updated by `obj_mesh_update_faces`
+    face_t* faces;
+    // optional hierarchy over `faces`, see `obj_mesh_build_bvh`
+    bvh_t* bvh;
+    // optional coarser versions of the mesh, finest first, see `obj_mesh_build_lods`
+    struct mesh** lods;
+    size_t n_lods;
+    // the mesh itself and all of its arrays, `bvh` included, are allocated from it
+    ut_arena_t* arena;
     /*
-     * 2D array that defines the surfaces of the solid.
-     * Its rows consist of the following data:a
-     *   -- 4 indexes
-     *   -- connection type (connection_t enum)
-     *   -- a character that indicates the color of the current surface
-     * To define a rectangular surface, use:
-     * {3, 4, 6, 7, CONNECTION_RECT, 'o'},
-     * For a triangular surface:
-     * {3, 4, 6, -1, CONNECTION_TRIANGLE, 'o'},
-     * Last index in triangular surface is always ignored. The generated surface
-     * will be spanned by vertices[3], [4], [6], [7] or [3], [4], [6] respectively
-     * and painted with the 'o' character.
+     * Faces are one-sided by default: their normal, as given by the winding of
+     * their first three vertices (see `obj_plane_set`), points out of the mesh
+     * and the renderer skips them when they face away from the camera. Open
+     * meshes, whose inside can be seen, have to be two-sided.
      */
-    int** connections;
+    bool is_two_sided;
+    // set when the mesh is rotated or translated, until its vertices and faces
+    // are moved along with it by `obj_mesh_lod`
+    bool is_moved;
 } mesh_t;
 
+/*
+ * Meshes that are drawn together. Each mesh keeps its own transform (it's
+ * rotated and translated on its own) and the renderer draws all of them in
+ * one pass, see `render_write_scene`.
+ */
+typedef struct scene {
+    // the scene itself and `meshes` are allocated from it
+    ut_arena_t* arena;
+    mesh_t** meshes;
+    size_t n_meshes;
+    // room in `meshes`
+    size_t capacity;
+} scene_t;
+
 typedef struct ray {
     // origin is the centre of perspective in pinhole camera model
     vec3i_t* orig;
@@ -105,10 +269,150 @@ mesh_t*     obj_triangle_new           (vec3i_t* p0, vec3i_t* p1, vec3i_t* p2, c
 */
 mesh_t*     obj_mesh_from_file         (const char* fpath, int cx, int cy, int cz,
                                         unsigned width, unsigned height, unsigned depth);
+/**
+ * @brief Makes an instance of a mesh - a mesh that shares its rest pose and
+ *        connections (see `mesh_t`) and has its own transform, color and
+ *        transformed vertices. The instance starts where the mesh was loaded
+ *        and can be rotated and translated on its own. Instances must be freed
+ *        before the mesh they're made from.
+ *
+ * @param mesh  Pointer to the mesh to make an instance of - if it's an instance
+ *              itself, the new one shares the data of its prototype
+ * @param color Color of all faces of the instance or 0 to keep the mesh's colors
+ *
+ * @returns A pointer to the newly constructed instance
+ */
+mesh_t*     obj_mesh_instance_new      (const mesh_t* mesh, color_t color);
+/**
+ * @brief Rotates a mesh about its center to the orientation of Euler angles,
+ *        from its rest pose. Only the pose and `bounding_box` (one that holds
+ *        the mesh) are updated - `vertices` and `faces` are brought to the
+ *        pose by `obj_mesh_pose`, `obj_mesh_update_faces` or `obj_mesh_lod`,
+ *        which callers that read them must call first.
+ *
+ * @param[in/out] mesh Pointer to the mesh
+ * @param         angle_x_rad, angle_y_rad, angle_z_rad Angles about x, y and z
+ */
 void        obj_mesh_rotate_to            (mesh_t* mesh, float angle_x_rad, float angle_y_rad, float angle_z_rad);
+/* like `obj_mesh_rotate_to` with angles in fixed point (see `VEC_ANGLE_STEPS`),
+ * without any floating point maths in integer-only builds */
+void        obj_mesh_rotate_to_fixed      (mesh_t* mesh, int angle_x, int angle_y, int angle_z);
+/**
+ * @brief Rotates a mesh about its center to the orientation of a quaternion,
+ *        like `obj_mesh_rotate_to` but without Euler angles, so without any
+ *        trigonometry or gimbal lock
+ *
+ * @param[in/out] mesh Pointer to the mesh
+ * @param[in]     quat Pointer to the quaternion, must not be 0
+ */
+void        obj_mesh_rotate_to_quat       (mesh_t* mesh, const quat_t* quat);
+/* like `obj_mesh_rotate_to_quat` with a quaternion in fixed point whose
+ * components are 16-bit numbers, such as the sensor's, without any floating
+ * point maths in integer-only builds */
+void        obj_mesh_rotate_to_quat_fixed (mesh_t* mesh, const quati_t* quat);
+/**
+ * @brief Moves a mesh, like `obj_mesh_rotate_to` only its pose and
+ *        `bounding_box` are updated
+ *
+ * @param[in/out] mesh Pointer to the mesh
+ * @param         dx, dy, dz Translation, rounded to whole units
+ */
 void        obj_mesh_translate_by         (mesh_t* mesh, float dx, float dy, float dz);
+/**
+ * @brief Brings the vertices, box and faces of a mesh to the pose it was
+ *        rotated and translated to, if it moved since they were.
+ *
+ * @param[in/out] mesh Pointer to the mesh
+ */
+void        obj_mesh_pose                 (mesh_t* mesh);
+/**
+ * @brief Recomputes the plane and edges of each face from the vertices, posing
+ *        the mesh first if it moved. `obj_mesh_lod` calls this already.
+ *
+ * @param[in/out] mesh Pointer to the mesh whose `faces` to update
+ */
+void        obj_mesh_update_faces         (mesh_t* mesh);
+/**
+ * @brief Builds a bounding volume hierarchy over the faces of a mesh so that
+ *        the faces under a pixel are found in O(log n_faces). It's refitted,
+ *        not rebuilt, whenever the faces are updated, which keeps its
+ *        topology - fine as long as the mesh is only rotated and translated.
+ *
+ * @param[in/out] mesh Pointer to the mesh whose `bvh` to (re)build
+ */
+void        obj_mesh_build_bvh            (mesh_t* mesh);
+/**
+ * @brief Recomputes the rectangles of the nodes of a mesh's hierarchy from
+ *        the current rectangles of its faces, bottom up.
+ *
+ * @param[in/out] mesh Pointer to the mesh whose `bvh` to refit
+ */
+void        obj_mesh_refit_bvh            (mesh_t* mesh);
+/**
+ * @brief Finds the faces that aren't culled and whose rectangle (see `face_t`)
+ *        overlaps a rectangle of the xy plane, through the mesh's hierarchy if
+ *        it has one or by testing each face otherwise.
+ *
+ * @param[in]  mesh  Pointer to the mesh
+ * @param      xmin, ymin, xmax, ymax Bounds of the rectangle, inclusive
+ * @param[out] faces Indexes of the faces found, room for `n_faces` of them.
+ *                   They are grouped by type in the order of `connection_t`,
+ *                   like `connections` - in increasing order without a
+ *                   hierarchy and in the order of its leaves with one.
+ *
+ * @return Number of faces found
+ */
+size_t      obj_mesh_faces_in_rect        (const mesh_t* mesh, int xmin, int ymin, int xmax, int ymax,
+                                           size_t* faces);
+/**
+ * @brief Builds coarser versions (levels of detail) of a mesh by collapsing
+ *        its shortest edges. Rectangles are split into triangles along their
+ *        p0-p2 diagonal, like the renderer does, and each level has at most
+ *        half the faces of the previous one. Collapses that would flip a face
+ *        are skipped so levels may end up with more faces than that, in which
+ *        case no further levels are built. Levels are only built once, for
+ *        a mesh that isn't an instance, and instances made before they are
+ *        don't get them.
+ *
+ * @param[in/out] mesh     Pointer to the mesh whose `lods` to build
+ * @param         n_levels Most levels to build, not counting the mesh itself
+ */
+void        obj_mesh_build_lods           (mesh_t* mesh, size_t n_levels);
+/**
+ * @brief Gets a level of detail of a mesh, moved to where the mesh is. Meshes
+ *        and their levels are only rotated and translated when they're asked
+ *        for, so that only those that are drawn are.
+ *
+ * @param[in/out] mesh  Pointer to the mesh
+ * @param         level 0 for the mesh itself, i for `mesh->lods[i - 1]`
+ *
+ * @return A pointer to the level
+ */
+mesh_t*     obj_mesh_lod                  (mesh_t* mesh, size_t level);
+/* frees the mesh along with its levels of detail, i.e. their arenas */
 void        obj_mesh_free              (mesh_t* mesh);
 
+//-------------------------------------------------------------------------------------------------------------
+// Scene
+//-------------------------------------------------------------------------------------------------------------
+/**
+ * @brief Allocates an empty scene from an arena with room for `capacity` meshes
+ *
+ * @param capacity Number of meshes the scene holds before `meshes` grows
+ * @return A pointer to the newly constructed scene
+ */
+scene_t*    obj_scene_new               (size_t capacity);
+/**
+ * @brief Adds a mesh to a scene, which takes ownership of it. Past its capacity,
+ *        `meshes` is copied to twice the room in the scene's arena.
+ *
+ * @param[in/out] scene Pointer to the scene
+ * @param         mesh  Pointer to the mesh to add
+ */
+void        obj_scene_add               (scene_t* scene, mesh_t* mesh);
+/* frees the scene along with its meshes, i.e. their arenas and its own */
+void        obj_scene_free              (scene_t* scene);
+
 //-------------------------------------------------------------------------------------------------------------
 // Ray
 //-------------------------------------------------------------------------------------------------------------
@@ -163,11 +467,52 @@ void        obj_camera_set              (camera_t* camera, int cam_x0, int cam_y
 plane_t*    obj_plane_new                  ();
 /* recompute plane's normal and offset given 3 points */
 void        obj_plane_set                  (plane_t* plane, vec3i_t* p0, vec3i_t* p1, vec3i_t* p2);
+/**
+ * @brief Sets the fixed-point depth of a plane, see `plane_depth_t`. Planes
+ *        seen edge-on (normal.z = 0) have no depth and get all zeros.
+ *
+ * @param[in]  plane Pointer to the plane
+ * @param[out] depth Pointer to its depth
+ */
+void        obj_plane_set_depth            (plane_t* plane, plane_depth_t* depth);
+/* sets the edge function of segment pq, see `edge_t` */
+void        obj_edge_set                   (edge_t* edge, vec3i_t* p, vec3i_t* q);
+/**
+ * @brief Whether point m lies inside triangle (a, b, c) in the xy plane, either
+ *        winding. Points on an edge or a vertex count as inside, so two faces
+ *        sharing an edge both claim it and leave no gap between them.
+ */
 bool        obj_is_point_in_triangle       (vec3i_t* m, vec3i_t* a, vec3i_t* b, vec3i_t* c);
+/* whether point m lies strictly inside rectangle abcd, points on an edge don't */
 bool        obj_is_point_in_rect           (vec3i_t* m, vec3i_t* a, vec3i_t* b, vec3i_t* c, vec3i_t* d);
 vec3i_t     render__ray_plane_intersection (plane_t* plane, ray_t* ray);
-bool        obj_ray_hits_rectangle         (ray_t* ray, vec3i_t** points);
-bool        obj_ray_hits_triangle          (ray_t* ray, vec3i_t** points);
+/**
+ * @brief Whether a ray hits a rectangular face. The face is tested as the two
+ *        triangles (p0, p1, p2) and (p0, p2, p3) split along its p0-p2 diagonal
+ *        with `obj_is_point_in_triangle`, not with `obj_is_point_in_rect`: once
+ *        rotated its rounded vertices no longer make an exact rectangle. Points
+ *        on its edges and on the diagonal count as hits.
+ */
+bool        obj_ray_hits_rectangle         (ray_t* ray, face_t* face);
+/* whether a ray hits the triangular face (p0, p1, p2), edges included */
+bool        obj_ray_hits_triangle          (ray_t* ray, face_t* face);
+/**
+ * @brief Casts rays at a rectangle through a horizontal run of `OBJ_RUN_LENGTH`
+ *        pixels, (x, y), (x + 1, y), ..., all at once. It's vectorized with AVX2,
+ *        SSE2 or NEON, whichever is enabled at compile time, and gives the same
+ *        results as `obj_ray_hits_rectangle`, which it falls back to otherwise -
+ *        bar ARMv7's NEON, whose division is approximate.
+ *
+ * @param[in]  face   Pointer to the face to test, a rectangle
+ * @param      x      x-coordinate of the first pixel of the run
+ * @param      y      y-coordinate of the pixels of the run
+ * @param[out] z_hits `OBJ_RUN_LENGTH` depths of the face's plane under the pixels
+ *
+ * @return Coverage mask - bit i is set if the ray through (x + i, y) hits the face
+ */
+unsigned    obj_ray_hits_rectangle_run     (face_t* face, int x, int y, int* z_hits);
+/* same as `obj_ray_hits_rectangle_run` for a triangle, see `obj_ray_hits_triangle` */
+unsigned    obj_ray_hits_triangle_run      (face_t* face, int x, int y, int* z_hits);
 void        obj_plane_free                 (plane_t* plane);
 
 /*
@@ -178,15 +523,16 @@ void        obj_plane_free                 (plane_t* plane);
  * defined yet, but it's defined later according to the expansion we want.
  * It maps the following information:
  * <connection letter in .scl file> -> <connection index> -> <intersection function>
+ * -> <intersection function of runs of pixels>
  *
  * Connection types are defined as an enum in objects.h.
  * Intersection functions define whether the ray intersects a rectangle or
- * triangle. As a final note, all functions must take the same parameter
- * types since we later expand them as a function pointer table.
+ * triangle. As a final note, all functions of a column must take the same
+ * parameter types since we later expand them as cases of one switch.
  */
-#define CONN_TABLE                                          \
-        X('R', CONNECTION_RECT,     obj_ray_hits_rectangle) \
-        X('T', CONNECTION_TRIANGLE, obj_ray_hits_triangle)
+#define CONN_TABLE                                                                      \
+        X('R', CONNECTION_RECT,     obj_ray_hits_rectangle, obj_ray_hits_rectangle_run) \
+        X('T', CONNECTION_TRIANGLE, obj_ray_hits_triangle,  obj_ray_hits_triangle_run)
 
 
 #endif /* OBJECTS_H */
@@ -4,24 +4,24 @@
 #include "screen.h"
 #include <stdbool.h>
 
+// depth of each pixel - only the pixels written in the current frame are valid
 extern int* g_z_buffer;
-// checks whether the ray hits each pixel
-extern plane_t* g_plane_test;
-// the 4 points that define the surface to render
-extern vec3i_t** g_surf_points;
-// checks whether the ray hits each pixel
-extern ray_t* g_ray_test;
 // camera where rays are shot from 
 extern camera_t g_camera;
 extern color_t g_colors_refl[32];
 extern bool g_use_perspective;
 extern bool g_use_reflectance;
+extern bool g_use_rasterizer;
+extern bool g_use_fixed_point;
+extern unsigned g_render_threads;
+extern unsigned g_render_supersamples;
 
 
 /**
  * @brief Use perspective transform (pinhole camera model) when rendering shapes. 
  *        After calling this function, call `render_init()` for the changes to
- *        take place.
+ *        take place. Shapes are then always rasterized - their vertices are
+ *        transformed once per frame and their faces clipped to the view frustum.
  *
  * @param center_x0    x-coordinate of the perspective center - aka the point
  *                     where rays are shot from
@@ -36,6 +36,45 @@ void render_use_perspective(int center_x0, int center_y0, float focal_length);
  */
 void render_use_reflectance();
 
+/**
+ * @brief Renders shapes with the rasterizer instead of casting a ray per pixel.
+ *        The rasterizer projects the vertices once per frame and fills each
+ *        face (triangle or rectangle) separately, so its cost grows with the
+ *        number of pixels the faces cover rather than with bounding box area
+ *        times number of faces.
+ */
+void render_use_rasterizer();
+
+/**
+ * @brief Replaces the floating point intersections and depths with integer
+ *        edge functions and fixed-point depths that are set up once per face
+ *        and stepped from pixel to pixel. It's faster without an FPU and
+ *        doesn't round intersections, so the output differs slightly.
+ *        Builds with `INTEGER_ONLY` defined always use it.
+ */
+void render_use_fixed_point();
+
+/**
+ * @brief Smooths the edges of shapes. Each cell is drawn from one sample as
+ *        usual, then the cells whose face differs from that of a neighbour are
+ *        sampled again at a grid of points and drawn with the glyph most of
+ *        them hit. Call it before `render_init()`. Builds with `INTEGER_ONLY`
+ *        defined don't supersample.
+ *
+ * @param n_samples Number of samples per edge cell, rounded to a square
+ *                  between 4 (2 by 2) and 16 (4 by 4)
+ */
+void render_use_supersampling(unsigned n_samples);
+
+/**
+ * @brief Renders with a fixed pool of threads. The screen is split into tiles
+ *        that the threads draw in parallel, the output being the same as with
+ *        a single thread. Call it before `render_init()`.
+ *
+ * @param n_threads Number of threads, including the calling one
+ */
+void render_use_threads(unsigned n_threads);
+
 /**
  * @brief Initializes renderer by setting the point of persperctive and focal length
  *        if projection is to be used
@@ -45,13 +84,24 @@ void render_init();
 /**
  * @brief Writes shape to screen buffer before it's rendered.
  *        Once shapes have been written, they can be displayed with `screen_flush()`
- *        (the latter is defined in screen.h)
+ *        (the latter is defined in screen.h). Shapes with levels of detail are
+ *        drawn at the coarsest level that has about a face per cell they cover.
  *
  * @param shape Pointer to the shape to write to the renderer. Note that it must be
  *              initialised 
  */
 void render_write_shape(mesh_t* shape);
 
+/**
+ * @brief Writes the meshes of a scene to the screen buffer in a single pass.
+ *        Meshes whose bounding box is off the screen are skipped and the rest
+ *        are drawn nearest first, so that the pixels of those behind them fail
+ *        the depth test early.
+ *
+ * @param scene Pointer to the scene to write to the renderer
+ */
+void render_write_scene(scene_t* scene);
+
 /**
  * @brief Sets the depth (z) buffer to INT_MAX and flushes the screen,
  *        drawing the pixels 
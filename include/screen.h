@@ -23,6 +23,38 @@ extern size_t g_buffer_size;
  */
 size_t screen_xy2ind(int x, int y);
 
+/**
+ * @brief Converts the y-coordinate of a pixel to the terminal row it's drawn at.
+ *        Rows are scaled by the aspect ratio of the terminal, so several
+ *        y-coordinates can share the same row.
+ *
+ * @param y y-coordinate of pixel
+ *
+ * @return the row of the pixel - it's outside [0, g_rows) for hidden pixels
+ */
+int screen_y2row(int y);
+
+/**
+ * @brief Gets the smallest and largest screen coordinates that are drawn inside
+ *        the terminal, i.e. those for which `screen_xy2ind` gives a valid index
+ *
+ * @param[out] xmin Smallest visible x-coordinate
+ * @param[out] ymin Smallest visible y-coordinate
+ * @param[out] xmax Largest visible x-coordinate
+ * @param[out] ymax Largest visible y-coordinate
+ */
+void screen_get_bounds(int* xmin, int* ymin, int* xmax, int* ymax);
+
+/**
+ * @brief Gets the range of (real) y-coordinates that are drawn at a row of the
+ *        terminal, the inverse of `screen_y2row`
+ *
+ * @param[in]  row  Row of the terminal
+ * @param[out] ymin Smallest y-coordinate of the row
+ * @param[out] ymax Largest y-coordinate of the row
+ */
+void screen_row2y(int row, float* ymin, float* ymax);
+
 /**
  * @brief Initialises the screen buffer and prepares terminal for writing
  */
@@ -37,9 +69,21 @@ void screen_init();
  * @param c "color" of the pixel as an ASCII character
  */
 void screen_write_pixel(int x, int y, color_t c);
+/**
+ * @brief Marks the pixels in a rectangle of screen coordinates as drawn in the
+ *        current frame. Only the cells of the terminal that are marked (in the
+ *        current or the previous frame) are drawn and emptied by `screen_flush`,
+ *        so every pixel written to the screen buffer must be in a marked one.
+ *
+ * @param xmin, ymin, xmax, ymax Bounds of the rectangle (inclusive), it's
+ *                               clipped to the terminal
+ */
+void screen_mark_dirty(int xmin, int ymin, int xmax, int ymax);
 /**
  * @brief Draws whatever is stored in the screen buffer `g_screen_buffer` on 
  *        the screen. Then moves the cursor top left and empties the buffer.
+ *        Only the cells marked by `screen_mark_dirty` in this frame or the
+ *        previous one are drawn, with the cursor moved to each of their rows.
  */
 void screen_flush();
 /**
@@ -2,6 +2,8 @@
 #define UTILS_H 
 
 #include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // int64_t
 
 // TODO:
 // #define INLINE inline __attribute__((always_inline))
@@ -43,6 +45,33 @@ inline bool ut_float_equal(float a, float b) {
     return (-1e-4 < a - b) && (a - b < 1e-4);
 }
 
+/* rounds n/d to the nearest integer, halves away from zero */
+static inline int64_t ut_div_round(int64_t n, int64_t d) {
+    return ((n < 0) == (d < 0)) ? (n + d/2)/d : (n - d/2)/d;
+}
+
+// alignment of the allocations of an arena, enough for SIMD loads
+#define UT_ARENA_ALIGN 16
+
+/*
+ * Memory that is handed out piece by piece and freed all at once. An arena is
+ * sized up front, e.g. from a counting pass, and chains another one to itself
+ * whenever it runs out, so it can also back things whose size isn't known,
+ * like scenes of many meshes.
+ */
+typedef struct ut_arena {
+    // arena allocations go to once this one is full, NULL until then
+    struct ut_arena* next;
+    size_t size;
+    size_t used;
+    unsigned char data[] __attribute__((aligned(UT_ARENA_ALIGN)));
+} ut_arena_t;
+
+/* room an allocation of `size` bytes takes in an arena */
+static inline size_t ut_arena_size(size_t size) {
+    return (size + UT_ARENA_ALIGN - 1) & ~(size_t) (UT_ARENA_ALIGN - 1);
+}
+
 
 /**
  * @brief Checks whether a null-terminated array of characters represents
@@ -53,4 +82,25 @@ inline bool ut_float_equal(float a, float b) {
  */
 bool ut_is_decimal(char* string);
 
+/**
+ * @brief Allocates an arena with room for `size` bytes, see `ut_arena_size`
+ *
+ * @param size Number of bytes the arena should hold before it grows
+ * @return A pointer to the newly constructed arena
+ */
+ut_arena_t* ut_arena_new(size_t size);
+
+/**
+ * @brief Hands out `size` bytes of an arena, aligned to `UT_ARENA_ALIGN`.
+ *        They're freed along with the arena.
+ *
+ * @param[in/out] arena Pointer to the arena
+ * @param[in]     size  Number of bytes
+ * @return A pointer to the bytes
+ */
+void*       ut_arena_alloc(ut_arena_t* arena, size_t size);
+
+/* frees an arena and everything allocated from it */
+void        ut_arena_free(ut_arena_t* arena);
+
 #endif /* UTILS_H */
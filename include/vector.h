@@ -2,6 +2,12 @@
 #define VECTOR_H 
 
 #include <stdbool.h> // bool 
+#include <stdint.h> // uint32_t
+
+// angles in fixed point are in steps of a full turn, a power of 2
+#define VEC_ANGLE_STEPS 4096
+// fractional bits of fixed-point sines and cosines
+#define VEC_FIXED_BITS 16
 
 typedef struct vec3i {
     int x, y, z;
@@ -14,6 +20,36 @@ typedef struct vec3f {
 // alias for floating vector type
 typedef vec3f_t vec3_t;
 
+// homogeneous point, e.g. in clip space
+typedef struct vec4f {
+    float x, y, z, w;
+} vec4_t;
+
+// 4x4 matrix that transforms homogeneous points, m[row][column]
+typedef struct mat4 {
+    float m[4][4];
+} mat4_t;
+
+// integer versions of the above, for transforms whose coefficients are integers
+typedef struct vec4i {
+    int x, y, z, w;
+} vec4i_t;
+
+typedef struct mat4i {
+    int m[4][4];
+} mat4i_t;
+
+// rotation as a quaternion w + xi + yj + zk, not necessarily of unit length
+typedef struct quat {
+    float w, x, y, z;
+} quat_t;
+
+// quaternion with integer components in any fixed point, such as the sensor's
+// 14 fractional bits
+typedef struct quati {
+    int w, x, y, z;
+} quati_t;
+
 // basic operations between floating vectors
 vec3_t*  vec_vec3_new           ();
 void     vec_vec3_set           (vec3_t* vec, float x, float y, float z);
@@ -37,6 +73,7 @@ vec3_t   vec_vec3_crossprod     (vec3_t* src1, vec3_t* src2);
  */
 void     vec_vec3_rotate        (vec3_t* src, float angle_x_rad, float angle_y_rad, float angle_z_rad,
                                  int x0, int y0, int z0);
+
 // basic operations between integral vectors
 vec3i_t* vec_vec3i_new          ();
 void     vec_vec3i_set          (vec3i_t* vec, int x, int y, int z);
@@ -69,4 +106,80 @@ vec3i_t  vec_vec3i_crossprod    (vec3i_t* src1, vec3i_t* src2);
 void     vec_vec3i_rotate       (vec3i_t* src, float angle_x_rad, float angle_y_rad, float angle_z_rad,
                                  int x0, int y0, int z0);
 
+// fixed-point angles, see `VEC_ANGLE_STEPS`
+int      vec_angle_from_rad     (float angle_rad);
+/* sine of a fixed-point angle, in fixed point with `VEC_FIXED_BITS` fractional bits */
+int      vec_sin_fixed          (int angle);
+int      vec_cos_fixed          (int angle);
+/**
+ * @brief Integer version of `vec_vec3i_rotate`, for CPUs without floating point
+ *        maths. Sines and cosines are looked up in a table.
+ *
+ * @param src[in/out] Pointer to vector to rotate, we write to that
+ * @param angle_x Angle to rotate about x axis, see `VEC_ANGLE_STEPS`
+ * @param angle_y Angle to rotate about y axis
+ * @param angle_z Angle to rotate about z axis
+ * @param x0 x-coordinate of point to rotate about
+ * @param y0 y-coordinate of point to rotate about
+ * @param z0 z-coordinate of point to rotate about
+ */
+void     vec_vec3i_rotate_fixed (vec3i_t* src, int angle_x, int angle_y, int angle_z,
+                                 int x0, int y0, int z0);
+
+// 4x4 matrices
+mat4_t   vec_mat4_identity      ();
+/**
+ * @brief Multiplies two matrices, so that the product applies `right` first
+ *        and then `left`
+ *
+ * @return left*right
+ */
+mat4_t   vec_mat4_mul           (const mat4_t* left, const mat4_t* right);
+/* transforms point (x, y, z, 1) */
+vec4_t   vec_mat4_apply         (const mat4_t* mat, const vec3i_t* point);
+/* rounds the coefficients of a matrix to integers */
+mat4i_t  vec_mat4_round         (const mat4_t* mat);
+/* transforms point (x, y, z, 1) with integer maths */
+vec4i_t  vec_mat4i_apply        (const mat4i_t* mat, const vec3i_t* point);
+/**
+ * @brief Makes the matrix of the rotation of `vec_vec3i_rotate` - about x, then
+ *        y, then z, about a point - so that it's computed once for all points
+ *        that are rotated the same way
+ *
+ * @param angle_x_rad Angle to rotate about x axis in radians
+ * @param angle_y_rad Angle to rotate about y axis in radians
+ * @param angle_z_rad Angle to rotate about z axis in radians
+ * @param x0 x-coordinate of point to rotate about
+ * @param y0 y-coordinate of point to rotate about
+ * @param z0 z-coordinate of point to rotate about
+ *
+ * @return T(x0, y0, z0)*Rz*Ry*Rx*T(-x0, -y0, -z0)
+ */
+mat4_t   vec_mat4_rotation      (float angle_x_rad, float angle_y_rad, float angle_z_rad, int x0, int y0, int z0);
+/* integer version of `vec_mat4_rotation`, see `vec_vec3i_rotate_fixed` - its
+ * coefficients are in fixed point with `VEC_FIXED_BITS` fractional bits */
+mat4i_t  vec_mat4i_rotation_fixed(int angle_x, int angle_y, int angle_z, int x0, int y0, int z0);
+/**
+ * @brief Makes the matrix of the rotation of a quaternion, without any
+ *        trigonometry. The quaternion is normalized on the way.
+ *
+ * @param quat Pointer to the quaternion, must not be 0
+ *
+ * @return Matrix that rotates points about the origin
+ */
+mat4_t   vec_mat4_from_quat     (const quat_t* quat);
+/* integer version of `vec_mat4_from_quat` - the components of the quaternion are
+ * 16-bit numbers in any fixed point, those of the matrix have `VEC_FIXED_BITS`
+ * fractional bits */
+mat4i_t  vec_mat4i_from_quat_fixed(int w, int x, int y, int z);
+/* quaternion of the rotation of `vec_mat4i_rotation_fixed` with 14 fractional bits */
+quati_t  vec_quati_from_angles_fixed(int angle_x, int angle_y, int angle_z);
+/* threshold of `vec_quati_is_turned` for an angle in radians (0 to pi), made
+ * once so that the comparisons themselves need no floating point maths */
+uint32_t vec_quat_turn_threshold(float angle_rad);
+/* whether the rotation from the orientation of quaternion `a` to that of `b`
+ * is larger than the angle of `threshold`, with integer maths only - their
+ * components must be below 2^15 in magnitude */
+bool     vec_quati_is_turned    (const quati_t* a, const quati_t* b, uint32_t threshold);
+
 #endif /* VECTOR_H */
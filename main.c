@@ -1,31 +1,82 @@
 #include "objects.h"
 #include "renderer.h"
 #include "arg_parser.h"
-#include "utils.h" // UT_MAX
+#include "utils.h" // ut_div_round
 #include <math.h> // sin, cos
 #include <unistd.h> // for usleep
 #include <stdlib.h> // exit
 #include <time.h> // time
 #include <signal.h> // signal
+#include <stdio.h> // fprintf
 
 #include "getbno055.h"
 
-/* Callback that clears the screen and makes the cursor visible when the user hits Ctr+C */
+// how far the objects turn per frame when benchmarking, times the rotation speed
+#define BENCH_RAD_PER_FRAME 0.02
+#ifdef INTEGER_ONLY
+#define BENCH_BUILD "integer-only"
+#else
+#define BENCH_BUILD "floating point"
+#endif
+// the sensor's quaternions have 14 fractional bits and its angles are in
+// sixteenths of a degree, which the doubles it hands out hold exactly
+#define SENSOR_QUAT_ONE (1 << 14)
+#define SENSOR_DEG_ONE  16
+
+// set when the user hits Ctr+C - the sensor loop then ends and the screen is
+// cleared outside of the handler, as little is safe to call from one
+static volatile sig_atomic_t g_is_interrupted = 0;
+
+/* Callback that stops the sensor loop when the user hits Ctr+C */
 static void interrupt_handler(int int_num) {
     if (int_num == SIGINT) {
-        render_end();
-        exit(SIGINT);
+        g_is_interrupted = 1;
     }
 }
 
+/* fixed-point angle (see `VEC_ANGLE_STEPS`) of one of the sensor's Euler angles in degrees */
+static int sensor_angle(double deg) {
+    const int deg_fixed = deg*SENSOR_DEG_ONE;
+    return ut_div_round((int64_t) deg_fixed*VEC_ANGLE_STEPS, 360*SENSOR_DEG_ONE) & (VEC_ANGLE_STEPS - 1);
+}
+
+/**
+ * @brief Renders a scene as fast as possible, spinning its meshes at the
+ *        rotation speeds rather than following the sensor
+ *
+ * @param scene    Pointer to the scene
+ * @param n_frames Number of frames to render
+ *
+ * @return Average time per frame in milliseconds
+ */
+static double bench_run(scene_t* scene, unsigned n_frames) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned frame = 0; frame < n_frames; ++frame) {
+        const float angle = frame*BENCH_RAD_PER_FRAME;
+        for (size_t i = 0; i < scene->n_meshes; ++i)
+            obj_mesh_rotate_to(scene->meshes[i], g_rot_speed_x*angle, g_rot_speed_y*angle, g_rot_speed_z*angle);
+        render_write_scene(scene);
+        render_flush();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)/1e6)/n_frames;
+}
+
 int main(int argc, char** argv) {
     arg_parse(argc, argv);
 
-    get_i2cbus(i2c_bus, senaddr);
-
-    set_mode(ndof);
+    // the benchmark doesn't need the sensor
+    if (g_bench_frames == 0) {
+        get_i2cbus(i2c_bus, senaddr);
+        set_mode(ndof);
+    }
 
     struct bnoeul bnod;
+    struct bnoqua bnoq;
+    // in fusion modes the sensor knows its absolute orientation, which is read
+    // as a quaternion rather than as Euler angles that lock up at ±90° pitch
+    const bool is_fusion = (g_bench_frames == 0) && (get_mode() >= imu);
 
     // make sure we end gracefully if the user hits Ctr+C
     signal(SIGINT, interrupt_handler);
@@ -33,26 +84,116 @@ int main(int argc, char** argv) {
     render_init();
 
     // mesh_t* shape = obj_mesh_from_file(g_mesh_file, g_cx, g_cy, g_cz, g_width, g_height, g_depth);
-    mesh_t* shape = obj_mesh_from_file(object_file, g_cx, g_cy, g_cz, g_cube_size, 1.2*g_cube_size, g_cube_size);
-
-	obj_mesh_translate_by(shape, g_move_x, g_move_y, g_move_z);
-	
-	do{    
-	get_eul(&bnod);
-	
-    	obj_mesh_rotate_to(shape,bnod.eul_pitc*M_PI/180,bnod.eul_head*M_PI/180,bnod.eul_roll*M_PI/180);
-    	render_write_shape(shape);
-    	render_flush();
+    mesh_t* meshes[ARG_MAX_OBJECTS];
+    for (unsigned i = 0; i < g_n_object_files; ++i) {
+        meshes[i] = obj_mesh_from_file(object_files[i], g_cx, g_cy, g_cz, g_cube_size, 1.2*g_cube_size, g_cube_size);
+        // small objects are drawn with fewer faces
+        if (g_lod_levels > 0) {
+            obj_mesh_build_lods(meshes[i], g_lod_levels);
+        }
+    }
+    // objects are laid out side by side along x, or cycled through the cells of
+    // a grid, centred on the screen - each cell is an instance of an object
+    const int n_cols = (g_grid_size > 0) ? g_grid_size : g_n_object_files;
+    const int n_rows = (g_grid_size > 0) ? g_grid_size : 1;
+    const int spacing = 1.5*g_cube_size;
+    scene_t* scene = obj_scene_new(n_rows*n_cols);
+    for (int i = 0; i < n_rows*n_cols; ++i) {
+        mesh_t* shape = obj_mesh_instance_new(meshes[i % g_n_object_files], 0);
+        // faces of large meshes are looked up through a hierarchy
+        if (g_use_bvh) {
+            obj_mesh_build_bvh(shape);
+        }
+        obj_mesh_translate_by(shape, g_move_x + (2*(i % n_cols) - (n_cols - 1))*spacing/2,
+                                     g_move_y - (2*(i / n_cols) - (n_rows - 1))*spacing/2, g_move_z);
+        obj_scene_add(scene, shape);
+    }
+
+    double ms_per_frame = 0;
+    // frames of the sensor loop and those of them that weren't drawn because the
+    // sensor had turned by less than the dead-band since the last one that was
+    unsigned long n_frames = 0;
+    unsigned long n_frames_skipped = 0;
+    if (g_bench_frames > 0) {
+        ms_per_frame = bench_run(scene, g_bench_frames);
+    } else {
+        // the pose of the last frame drawn, if one was drawn with the sensor's -
+        // Euler angles are compared as quaternions too, so that the dead-band
+        // is the angle the sensor turned by in both modes
+        quati_t drawn_quat;
+        bool has_drawn_pose = false;
+        bool is_drawn = false;
+        // compared to in fixed point, so that frames need no floating point maths
+        const uint32_t dead_band = vec_quat_turn_threshold(g_dead_band*M_PI/180);
 #ifndef _WIN32
-        // nanosleep does not work on Windows
-        nanosleep((const struct timespec[]) {{0, (int)(1.0 / g_fps * 1e9)}}, NULL);
+        const struct timespec frame_time = {0, (int)(1.0 / g_fps * 1e9)};
 #endif
-    
-    }while(1);
+        while (!g_is_interrupted) {
+            // objects are only moved and drawn again when the sensor turned by
+            // more than the dead-band, so an idle display costs next to nothing
+            bool is_turned = false;
+            if (is_fusion) {
+                get_qua(&bnoq);
+                // the axes of the Euler angles below - the sensor's z is the screen's y
+                // and swapping two axes mirrors the rotation, hence the signs
+                const quati_t quat = {bnoq.quater_w*SENSOR_QUAT_ONE, -bnoq.quater_x*SENSOR_QUAT_ONE,
+                                      -bnoq.quater_z*SENSOR_QUAT_ONE, -bnoq.quater_y*SENSOR_QUAT_ONE};
+                // all 0 until the sensor has an orientation
+                if ((quat.w != 0) || (quat.x != 0) || (quat.y != 0) || (quat.z != 0)) {
+                    is_turned = !has_drawn_pose || vec_quati_is_turned(&drawn_quat, &quat, dead_band);
+                    if (is_turned) {
+                        for (size_t i = 0; i < scene->n_meshes; ++i)
+                            obj_mesh_rotate_to_quat_fixed(scene->meshes[i], &quat);
+                        drawn_quat = quat;
+                    }
+                }
+            } else {
+                get_eul(&bnod);
+                const int pitch = sensor_angle(bnod.eul_pitc);
+                const int heading = sensor_angle(bnod.eul_head);
+                const int roll = sensor_angle(bnod.eul_roll);
+                const quati_t quat = vec_quati_from_angles_fixed(pitch, heading, roll);
+
+                is_turned = !has_drawn_pose || vec_quati_is_turned(&drawn_quat, &quat, dead_band);
+                if (is_turned) {
+                    for (size_t i = 0; i < scene->n_meshes; ++i)
+#ifdef INTEGER_ONLY
+                        obj_mesh_rotate_to_fixed(scene->meshes[i], pitch, heading, roll);
+#else
+                        obj_mesh_rotate_to(scene->meshes[i],bnod.eul_pitc*M_PI/180,bnod.eul_head*M_PI/180,bnod.eul_roll*M_PI/180);
+#endif
+                    drawn_quat = quat;
+                }
+            }
+            has_drawn_pose |= is_turned;
+            n_frames++;
+            // the first frame is drawn even if the sensor has no orientation yet
+            if (is_turned || !is_drawn) {
+                render_write_scene(scene);
+                render_flush();
+                is_drawn = true;
+            } else {
+                n_frames_skipped++;
+            }
+#ifndef _WIN32
+            // nanosleep does not work on Windows
+            nanosleep(&frame_time, NULL);
+#endif
+        }
+    }
 
-    obj_mesh_free(shape);
+    // instances go first
+    obj_scene_free(scene);
+    for (unsigned i = 0; i < g_n_object_files; ++i)
+        obj_mesh_free(meshes[i]);
     render_end();
+    // after the screen is cleared, on stderr so that runs can be collected
+    if (g_bench_frames > 0)
+        fprintf(stderr, "%s: %.3f ms/frame over %u frames\n", BENCH_BUILD, ms_per_frame, g_bench_frames);
+    if (n_frames > 0)
+        fprintf(stderr, "%lu of %lu frames skipped, the sensor turned by less than %g degrees\n",
+                n_frames_skipped, n_frames, g_dead_band);
 
-    return 0;
+    return g_is_interrupted ? SIGINT : 0;
 }
 
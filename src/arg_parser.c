@@ -42,6 +42,8 @@ unsigned g_bounce_every = 0;
 int g_move_x = 2;
 int g_move_y = 1;
 int g_move_z = 1;
+// whether to build a bounding volume hierarchy over the faces of the mesh
+bool g_use_bvh = false;
 
 // Global variables and defaults 
 int g_cube_size = 50;
@@ -49,6 +51,13 @@ int verbose = 0;
 char senaddr[256] = "0x28";
 char i2c_bus[256] = "/dev/i2c-1";
 char object_file[256] = "./mesh_files/cube.scl";
+char object_files[ARG_MAX_OBJECTS][256] = {"./mesh_files/cube.scl"};
+// the default file counts until a file is given
+unsigned g_n_object_files = 1;
+unsigned g_grid_size = 0;
+unsigned g_lod_levels = 0;
+unsigned g_bench_frames = 0;
+float g_dead_band = 0.5;
 
 
 void arg_parse(int argc, char** argv) {
@@ -70,8 +79,17 @@ void arg_parse(int argc, char** argv) {
 		else if (strcmp(argv[i], "--help") == 0) {
 	    	printf("\n");    
 	    	printf("--i2cbus: Put the address of the i2c bus (default: /dev/i2c-1)\n");
-	    	printf("--object-file: Address to the object (default: ./mesh_files/cube.scl)\n");
+	    	printf("--object-file: Address to the object (default: ./mesh_files/cube.scl), repeat it to draw several objects side by side\n");
 	    	printf("--size: Determine the size of the object (default: 50)\n");
+	    	printf("--rasterize: Fill faces with the rasterizer instead of casting rays\n");
+	    	printf("--fixed-point: Use integer maths instead of floating point to find what faces cover\n");
+	    	printf("--threads: Number of threads that render the screen in tiles (default: 1)\n");
+	    	printf("--supersample: Smooth the edges of faces with N samples per cell on them (4 to 16)\n");
+	    	printf("--bvh: Look up the faces of large meshes through a bounding volume hierarchy\n");
+	    	printf("--lod: Build up to N coarser versions of each object, drawn when it covers few cells\n");
+	    	printf("--grid: Draw the objects N times in an N by N grid, sharing the data of each object\n");
+	    	printf("--benchmark: Render N frames without the sensor as fast as possible and print the time per frame\n");
+	    	printf("--dead-band: Degrees the sensor must turn by before the objects are drawn again (default: 0.5)\n");
 	    	printf("--help: show this message\n");
 	    	printf("\n");
 	    	exit(0);
@@ -85,9 +103,35 @@ void arg_parse(int argc, char** argv) {
             g_max_iterations = atoi(argv[++i]);
         } else if ((strcmp(argv[i], "--use-perspective") == 0) || (strcmp(argv[i], "-up") == 0)) {
             render_use_perspective(0, 0, -200);
+        } else if ((strcmp(argv[i], "--rasterize") == 0) || (strcmp(argv[i], "-ra") == 0)) {
+            render_use_rasterizer();
+        } else if ((strcmp(argv[i], "--fixed-point") == 0) || (strcmp(argv[i], "-fp") == 0)) {
+            render_use_fixed_point();
+        } else if ((strcmp(argv[i], "--threads") == 0) || (strcmp(argv[i], "-th") == 0)) {
+            render_use_threads(atoi(argv[++i]));
+        } else if ((strcmp(argv[i], "--supersample") == 0) || (strcmp(argv[i], "-ss") == 0)) {
+            render_use_supersampling(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bvh") == 0) {
+            g_use_bvh = true;
+        } else if (strcmp(argv[i], "--lod") == 0) {
+            g_lod_levels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--grid") == 0) {
+            g_grid_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            g_bench_frames = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "--dead-band") == 0) || (strcmp(argv[i], "-db") == 0)) {
+            g_dead_band = atof(argv[++i]);
         } else if ((strcmp(argv[i], "--object-file") == 0)) {
             i++;
-            strcpy(object_file, argv[i]);
+            // the first file replaces the default one, the next ones are added to it
+            static bool is_object_file_set = false;
+            if (!is_object_file_set) {
+                g_n_object_files = 0;
+                strcpy(object_file, argv[i]);
+                is_object_file_set = true;
+            }
+            if (g_n_object_files < ARG_MAX_OBJECTS)
+                strcpy(object_files[g_n_object_files++], argv[i]);
         } else if ((strcmp(argv[i], "--movex") == 0) || (strcmp(argv[i], "-mx") == 0)) {
             g_move_x = atoi(argv[++i]);
         } else if ((strcmp(argv[i], "--movey") == 0) || (strcmp(argv[i], "-my") == 0)) {
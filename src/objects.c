@@ -1,15 +1,20 @@
 #include "vector.h"
 #include "objects.h"
 #include "utils.h"
-#include "renderer.h" // g_plane_test
 #include <math.h> // round, abs
 #include <stdlib.h>
 #include <stdbool.h> // bool
 #include <stddef.h> // size_t
 #include <stdio.h> // FILE, open, fclose, printf
 #include <ctype.h> // isempty
-#include <string.h> // strtok
+#include <string.h> // strtok, memcpy
 #include <assert.h> // assert
+#include <limits.h> // INT_MAX, INT_MIN
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h> // SSE2/AVX2 intrinsics
+#elif defined(__ARM_NEON)
+#include <arm_neon.h> // NEON intrinsics
+#endif
 
 
 // perpendicular 2D vector, i.e. rotated by 90 degrees ccw
@@ -26,13 +31,13 @@
 #define VEC_PERP_DOT_PROD(a, b) a.x*b.y - a.y*b.x
 
 static char conn_letters[] = {
-#define X(a, b, c) a,
+#define X(a, b, c, d) a,
     CONN_TABLE
 #undef X
 };
 
 static int conn_names[NUM_CONNECTIONS] = {
-#define X(a, b, c) b,
+#define X(a, b, c, d) b,
     CONN_TABLE
 #undef X
 };
@@ -44,6 +49,15 @@ static inline bool obj__starts_with(const char* buffer, char first) {
     return buffer[0] == first;
 }
 
+/* connection type of the letter that names it in mesh files */
+static inline int obj__conn_type(char letter) {
+    for (int i = 0; i < NUM_CONNECTIONS; ++i) {
+        if (letter == conn_letters[i])
+            return conn_names[i];
+    }
+    return CONNECTION_RECT;
+}
+
 static inline bool obj__line_is_comment(const char* buffer) {
     return buffer[0] == '#';
 }
@@ -58,18 +72,133 @@ bool obj__line_is_empty(const char *s)
   return true;
 }
 
+static inline void obj__bbox_reset(struct bounding_box* bbox) {
+    bbox->x0 = bbox->y0 = bbox->z0 = INT_MAX;
+    bbox->x1 = bbox->y1 = bbox->z1 = INT_MIN;
+}
+
+static inline void obj__bbox_add(struct bounding_box* bbox, const vec3i_t* v) {
+    bbox->x0 = UT_MIN(bbox->x0, v->x);
+    bbox->y0 = UT_MIN(bbox->y0, v->y);
+    bbox->z0 = UT_MIN(bbox->z0, v->z);
+    bbox->x1 = UT_MAX(bbox->x1, v->x);
+    bbox->y1 = UT_MAX(bbox->y1, v->y);
+    bbox->z1 = UT_MAX(bbox->z1, v->z);
+}
+
+/* tightest axis aligned box that contains the vertices of the mesh */
 static inline void obj__mesh_update_bbox(mesh_t* mesh) {
-    const int w = mesh->bounding_box.width;
-    const int h = mesh->bounding_box.height;
-    const int d = mesh->bounding_box.depth;
-    const int m = 2*sqrt(w*w + h*h + d*d);
-    mesh->bounding_box.x0 = mesh->center->x - m/2;
-    mesh->bounding_box.y0 = mesh->center->y - m/2;
-    mesh->bounding_box.z0 = mesh->center->z - m/2;
-    mesh->bounding_box.x1 = mesh->center->x + m/2;
-    mesh->bounding_box.y1 = mesh->center->y + m/2;
-    mesh->bounding_box.z1 = mesh->center->z + m/2;
+    obj__bbox_reset(&mesh->bounding_box);
+    for (size_t i = 0; i < mesh->n_vertices; ++i)
+        obj__bbox_add(&mesh->bounding_box, &mesh->vertices[i]);
+}
+
+#ifdef INTEGER_ONLY
+/* rotation matrix that leaves vertices where they are */
+static inline rot_mat_t obj__no_rotation() {
+    return vec_mat4i_rotation_fixed(0, 0, 0, 0, 0, 0);
+}
+
+/* moves points of the rest pose of a mesh by its offset and then rotates them
+ * about its center by `mesh->rotation`, which is in fixed point */
+static void obj__mesh_transform(const mesh_t* mesh, const vec3i_t* restrict src, vec3i_t* restrict dst, size_t n) {
+    const int64_t half = 1 << (VEC_FIXED_BITS - 1);
+    // v = R*(v + offset - C) + C, the translation is worked out once for all
+    // vertices, in 64 bits as it's in fixed point
+    const int64_t c[3] = {mesh->center->x, mesh->center->y, mesh->center->z};
+    const vec3i_t d = vec_vec3i_sub((vec3i_t*) &mesh->offset, mesh->center);
+    int64_t m[3][4];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j)
+            m[i][j] = mesh->rotation.m[i][j];
+        m[i][3] = c[i]*(1 << VEC_FIXED_BITS) + m[i][0]*d.x + m[i][1]*d.y + m[i][2]*d.z;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const int64_t x = src[i].x, y = src[i].y, z = src[i].z;
+        dst[i].x = (m[0][0]*x + m[0][1]*y + m[0][2]*z + m[0][3] + half) >> VEC_FIXED_BITS;
+        dst[i].y = (m[1][0]*x + m[1][1]*y + m[1][2]*z + m[1][3] + half) >> VEC_FIXED_BITS;
+        dst[i].z = (m[2][0]*x + m[2][1]*y + m[2][2]*z + m[2][3] + half) >> VEC_FIXED_BITS;
+    }
+}
+#else
+/* rotation matrix that leaves vertices where they are */
+static inline rot_mat_t obj__no_rotation() {
+    return vec_mat4_identity();
+}
+
+/* rounds halves away from zero like `round`, but is cheap enough to be inlined */
+static inline int obj__round(float f) {
+    return (int) (f + ((f < 0) ? -0.5f : 0.5f));
+}
+
+/* moves points of the rest pose of a mesh by its offset and then rotates them
+ * about its center by `mesh->rotation` */
+static void obj__mesh_transform(const mesh_t* mesh, const vec3i_t* restrict src, vec3i_t* restrict dst, size_t n) {
+    // v = R*(v + offset - C) + C, the translation is worked out once for all vertices
+    const float c[3] = {mesh->center->x, mesh->center->y, mesh->center->z};
+    const vec3i_t d = vec_vec3i_sub((vec3i_t*) &mesh->offset, mesh->center);
+    float m[3][4];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j)
+            m[i][j] = mesh->rotation.m[i][j];
+        m[i][3] = c[i] + m[i][0]*d.x + m[i][1]*d.y + m[i][2]*d.z;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const float x = src[i].x, y = src[i].y, z = src[i].z;
+        dst[i].x = obj__round(m[0][0]*x + m[0][1]*y + m[0][2]*z + m[0][3]);
+        dst[i].y = obj__round(m[1][0]*x + m[1][1]*y + m[1][2]*z + m[1][3]);
+        dst[i].z = obj__round(m[2][0]*x + m[2][1]*y + m[2][2]*z + m[2][3]);
+    }
+}
+#endif
+
+/* Only stores that a mesh moved - its vertices and faces are brought to its
+ * pose when they're asked for (see `obj_mesh_pose`), which the renderer only
+ * does for meshes on the screen at the level of detail they're drawn with (see
+ * `obj_mesh_lod`). Until then its box is the one around its rest pose's box in
+ * that pose, which holds the vertices as the transform is linear. */
+static void obj__mesh_move(mesh_t* mesh) {
+    const struct bounding_box* rest = &mesh->rest_box;
+    vec3i_t corners[8], moved[8];
+    for (int i = 0; i < 8; ++i)
+        vec_vec3i_set(&corners[i], (i & 1) ? rest->x1 : rest->x0, (i & 2) ? rest->y1 : rest->y0,
+                                   (i & 4) ? rest->z1 : rest->z0);
+    obj__mesh_transform(mesh, corners, moved, 8);
+    obj__bbox_reset(&mesh->bounding_box);
+    for (int i = 0; i < 8; ++i)
+        obj__bbox_add(&mesh->bounding_box, &moved[i]);
+    mesh->is_moved = true;
 }
+
+/* allocates a mesh and its arrays from an arena of their size and zeroes the rest */
+static mesh_t* obj__mesh_alloc(size_t n_verts, size_t n_faces) {
+    const size_t size = ut_arena_size(sizeof(mesh_t)) + ut_arena_size(sizeof(vec3i_t)) +
+                        2*ut_arena_size(sizeof(vec3i_t) * n_verts) +
+                        ut_arena_size(sizeof(conn_t) * n_faces) + ut_arena_size(sizeof(face_t) * n_faces);
+    ut_arena_t* arena = ut_arena_new(size);
+    mesh_t* new = ut_arena_alloc(arena, sizeof(mesh_t));
+    new->arena = arena;
+    new->center = ut_arena_alloc(arena, sizeof(vec3i_t));
+    vec_vec3i_set(new->center, 0, 0, 0);
+    new->n_vertices = n_verts;
+    new->n_faces = n_faces;
+    new->is_two_sided = false;
+    new->offset = (vec3i_t) {0, 0, 0};
+    new->rotation = obj__no_rotation();
+    new->prototype = NULL;
+    new->color = 0;
+    // vertices are stored next to each other, as is the rest pose
+    new->vertices = ut_arena_alloc(arena, sizeof(vec3i_t) * n_verts);
+    new->vertices_backup = ut_arena_alloc(arena, sizeof(vec3i_t) * n_verts);
+    // one record per surface that indicates how vertices are connected at it
+    new->connections = ut_arena_alloc(arena, sizeof(conn_t) * n_faces);
+    new->faces = ut_arena_alloc(arena, sizeof(face_t) * n_faces);
+    new->bvh = NULL;
+    new->lods = NULL;
+    new->n_lods = 0;
+    return new;
+}
+
 //----------------------------------------------------------------------------------------------------------
 // Renderable shapes
 //----------------------------------------------------------------------------------------------------------
@@ -82,35 +211,36 @@ mesh_t* obj_mesh_from_file(const char* fpath, int cx, int cy, int cz, unsigned w
     }
     char buffer[128];
     size_t n_verts = 0, n_surfs = 0;
+    size_t n_surfs_of_type[NUM_CONNECTIONS] = {0};
     //// read numbers of vertices and surfaces
     while((fgets (buffer, 128, file))!= NULL) {
-        if (obj__starts_with(buffer, 'v'))
+        if (obj__starts_with(buffer, 'v')) {
             n_verts++;
-        else if (obj__starts_with(buffer, 'f'))
+        } else if (obj__starts_with(buffer, 'f')) {
             n_surfs++;
+            // the type is the fifth field
+            char* pch = strtok (buffer, " vf");
+            for (int i = 0; (i < 4) && (pch != NULL); ++i)
+                pch = strtok (NULL, " ");
+            n_surfs_of_type[obj__conn_type((pch != NULL) ? *pch : 0)]++;
+        }
     }
+    // surfaces of the same type are stored together, in the order of the file
+    size_t next_surf[NUM_CONNECTIONS];
+    for (size_t i = 0, first = 0; i < NUM_CONNECTIONS; first += n_surfs_of_type[i++])
+        next_surf[i] = first;
     //// allocate data and prepare for reading
     // this is what we want to return
-    mesh_t* new = malloc(sizeof(mesh_t));
+    mesh_t* new = obj__mesh_alloc(n_verts, n_surfs);
     new->bounding_box.width = width;
     new->bounding_box.height = height;
     new->bounding_box.depth = depth;
-    new->center = vec_vec3i_new();
     vec_vec3i_set(new->center, cx, cy, cz);
-    new->n_vertices = n_verts;
-    new->n_faces = n_surfs;
-    new->vertices = (vec3i_t**) malloc(sizeof(vec3i_t*) * n_verts);
-    new->vertices_backup = (vec3i_t**) malloc(sizeof(vec3i_t*) * n_verts);
-    obj__mesh_update_bbox(new);
-    // allocate 2D array that indicates how vertices are connected at each surface
-    new->connections = malloc(new->n_faces * sizeof(int*));
-    for (int i = 0; i < new->n_faces; ++i)
-        new->connections[i] = malloc(6 * sizeof(int));
 
     //// set vertices and surfaces
     // go back to beginning of the file
     fseek(file, 0, SEEK_SET);
-    size_t ivert = 0, isurf = 0;
+    size_t ivert = 0;
     while((fgets (buffer, 128, file)) != NULL) {
         char* pch = strtok (buffer, " vf");
         if (obj__starts_with(buffer, 'v')) {
@@ -119,48 +249,47 @@ mesh_t* obj_mesh_from_file(const char* fpath, int cx, int cy, int cz, unsigned w
             const float y = atof(pch);
             pch = strtok (NULL, " ");
             const float z = atof(pch);
-            new->vertices[ivert] = vec_vec3i_new();
-            vec_vec3i_set(new->vertices[ivert++], round(width/2*x), round(height/2*y), round(depth/2*z));
+            vec_vec3i_set(&new->vertices[ivert++], round(width/2*x), round(height/2*y), round(depth/2*z));
         } else if (obj__starts_with(buffer, 'f')) {
             assert(atoi(pch) <= new->n_vertices);
-            new->connections[isurf][0] = atoi(pch);
+            conn_t conn;
+            conn.indexes[0] = atoi(pch);
             pch = strtok (NULL, " ");
-            new->connections[isurf][1] = atoi(pch);
+            conn.indexes[1] = atoi(pch);
             pch = strtok (NULL, " ");
-            new->connections[isurf][2] = atoi(pch);
+            conn.indexes[2] = atoi(pch);
             pch = strtok (NULL, " ");
-            new->connections[isurf][3] = atoi(pch);
+            conn.indexes[3] = atoi(pch);
             pch = strtok (NULL, " ");
-            for (int i = 0; i < NUM_CONNECTIONS; ++i) {
-                if (*pch == conn_letters[i])
-                    new->connections[isurf][4] = conn_names[i];
-            }
+            conn.type = obj__conn_type(*pch);
             pch = strtok (NULL, " ");
-            new->connections[isurf][5] = *pch;
-            isurf++;
+            conn.color = *pch;
+            new->connections[next_surf[conn.type]++] = conn;
+        } else if (obj__starts_with(buffer, 's')) {
+            // number of sides the faces are drawn from - `pch` holds the "s"
+            pch = strtok (NULL, " ");
+            new->is_two_sided = (pch != NULL) && (atoi(pch) == 2);
         }
     }
     fclose(file);
     //// shift them to center and back them up
     for (int i = 0; i < new->n_vertices; ++i) {
-        *new->vertices[i] = vec_vec3i_add(new->vertices[i], new->center);
-        new->vertices_backup[i] = vec_vec3i_new();
-        vec_vec3i_set(new->vertices_backup[i], 0, 0, 0);
-        vec_vec3i_copy(new->vertices_backup[i], new->vertices[i]);
+        new->vertices[i] = vec_vec3i_add(&new->vertices[i], new->center);
+        new->vertices_backup[i] = new->vertices[i];
     }
+    obj__mesh_update_bbox(new);
+    new->rest_box = new->bounding_box;
+    obj_mesh_update_faces(new);
     return new;
 }
 
 mesh_t* obj_triangle_new(vec3i_t* p0, vec3i_t* p1, vec3i_t* p2, color_t color) {
-    mesh_t* new = malloc(sizeof(mesh_t));
-    new->center = malloc(sizeof(vec3i_t));
+    mesh_t* new = obj__mesh_alloc(3, 1);
     new->center->x = (p0->x + p1->x + p2->x)/3;
     new->center->y = (p0->y + p1->y + p2->y)/3;
     new->center->z = (p0->z + p1->z + p2->z)/3;
-    new->n_vertices = 3;
-    new->n_faces = 1;
-    new->vertices = (vec3i_t**) malloc(sizeof(vec3i_t*) * new->n_vertices);
-    new->vertices_backup = (vec3i_t**) malloc(sizeof(vec3i_t*) * new->n_vertices);
+    // a lone triangle has no inside so it can be seen from both sides
+    new->is_two_sided = true;
     unsigned width = UT_MAX( UT_MAX(abs(p0->x - p1->x), abs(p0->x - p2->x)),
                              UT_MAX(abs(p0->x - p1->x), abs(p1->x - p2->x)));
     unsigned height = UT_MAX(UT_MAX(abs(p0->y - p1->y), abs(p0->y - p2->y)),
@@ -168,75 +297,608 @@ mesh_t* obj_triangle_new(vec3i_t* p0, vec3i_t* p1, vec3i_t* p2, color_t color) {
     new->bounding_box.width = width;
     new->bounding_box.height = height;
     new->bounding_box.depth = 1;
-    new->vertices[0] = vec_vec3i_new();
-    new->vertices[1] = vec_vec3i_new();
-    new->vertices[2] = vec_vec3i_new();
-    vec_vec3i_set(new->vertices[0], p0->x, p0->y, p0->z);
-    vec_vec3i_set(new->vertices[1], p1->x, p1->y, p1->z);
-    vec_vec3i_set(new->vertices[2], p2->x, p2->y, p2->z);
-    obj__mesh_update_bbox(new);
-    obj__mesh_update_bbox(new);
-    obj__mesh_update_bbox(new);
+    vec_vec3i_set(&new->vertices[0], p0->x, p0->y, p0->z);
+    vec_vec3i_set(&new->vertices[1], p1->x, p1->y, p1->z);
+    vec_vec3i_set(&new->vertices[2], p2->x, p2->y, p2->z);
 
-    // allocate 2D array that indicates how vertices are connected at each surface
-    new->connections = malloc(new->n_faces * sizeof(int*));
-    for (int i = 0; i < new->n_faces; ++i)
-        new->connections[i] = malloc(6 * sizeof(int));
     // define surfaces
-    new->connections[0][0] = 0;
-    new->connections[0][1] = 1;
-    new->connections[0][2] = 2;
-    new->connections[0][3] = 0;
-    new->connections[0][4] = CONNECTION_TRIANGLE;
-    new->connections[0][5] = color;
+    new->connections[0] = (conn_t) {{0, 1, 2, 0}, CONNECTION_TRIANGLE, color};
 
     // finish creating the vertices - shift the to the mesh's origin, back them up
     for (int i = 0; i < new->n_vertices; ++i) {
-        *new->vertices[i] = vec_vec3i_add(new->vertices[i], new->center);
-        new->vertices_backup[i] = vec_vec3i_new();
-        vec_vec3i_set(new->vertices_backup[i], 0, 0, 0);
-        vec_vec3i_copy(new->vertices_backup[i], new->vertices[i]);
+        new->vertices[i] = vec_vec3i_add(&new->vertices[i], new->center);
+        new->vertices_backup[i] = new->vertices[i];
     }
+    obj__mesh_update_bbox(new);
+    new->rest_box = new->bounding_box;
+    obj_mesh_update_faces(new);
+    return new;
+}
+
+mesh_t* obj_mesh_instance_new(const mesh_t* mesh, color_t color) {
+    const mesh_t* prototype = (mesh->prototype != NULL) ? mesh->prototype : mesh;
+    const size_t size = ut_arena_size(sizeof(mesh_t)) + ut_arena_size(sizeof(vec3i_t)) +
+                        ut_arena_size(sizeof(vec3i_t) * prototype->n_vertices) +
+                        ut_arena_size(sizeof(face_t) * prototype->n_faces) +
+                        ut_arena_size(sizeof(mesh_t*) * prototype->n_lods);
+    ut_arena_t* arena = ut_arena_new(size);
+    mesh_t* new = ut_arena_alloc(arena, sizeof(mesh_t));
+    *new = *prototype;
+    new->arena = arena;
+    new->prototype = prototype;
+    new->color = color;
+    // the instance starts at the rest pose, around the center it was loaded with
+    new->center = ut_arena_alloc(arena, sizeof(vec3i_t));
+    *new->center = vec_vec3i_sub(prototype->center, (vec3i_t*) &prototype->offset);
+    new->offset = (vec3i_t) {0, 0, 0};
+    new->rotation = obj__no_rotation();
+    new->is_moved = false;
+    // only the transformed vertices are its own
+    new->vertices = ut_arena_alloc(arena, sizeof(vec3i_t) * prototype->n_vertices);
+    memcpy(new->vertices, prototype->vertices_backup, sizeof(vec3i_t) * prototype->n_vertices);
+    new->faces = ut_arena_alloc(arena, sizeof(face_t) * prototype->n_faces);
+    new->bvh = NULL;
+    // levels of detail move with the instance
+    new->lods = ut_arena_alloc(arena, sizeof(mesh_t*) * prototype->n_lods);
+    for (size_t i = 0; i < prototype->n_lods; ++i)
+        new->lods[i] = obj_mesh_instance_new(prototype->lods[i], color);
+    obj__mesh_update_bbox(new);
+    obj_mesh_update_faces(new);
     return new;
 }
 
 void obj_mesh_rotate_to (mesh_t* mesh, float angle_x_rad, float angle_y_rad, float angle_z_rad) {
-    for (size_t i = 0; i < mesh->n_vertices; ++i) {
-        // first, reset each vertex so no floating point error is accumulated
-        vec_vec3i_copy(mesh->vertices[i], mesh->vertices_backup[i]);
-
-        // point to rotate about
-        int x0 = mesh->center->x, y0 = mesh->center->y, z0 = mesh->center->z;
-        // rotate around x axis, then y, then z
-        // We rotate as follows (* denotes matrix product, C the mesh's origin):
-        // v = v - C, v = Rz*Ry*Rx*v, v = v + C
-        vec_vec3i_rotate(mesh->vertices[i], angle_x_rad, angle_y_rad, angle_z_rad, x0, y0, z0);
-    }
+    // We rotate as follows (* denotes matrix product, C the mesh's origin):
+    // v = v - C, v = Rz*Ry*Rx*v, v = v + C
+    // where Rz*Ry*Rx is one matrix for all vertices, made once per call
+#ifdef INTEGER_ONLY
+    // the angles are converted once, the vertices are rotated with integer maths
+    obj_mesh_rotate_to_fixed(mesh, vec_angle_from_rad(angle_x_rad), vec_angle_from_rad(angle_y_rad),
+                             vec_angle_from_rad(angle_z_rad));
+#else
+    mesh->rotation = vec_mat4_rotation(angle_x_rad, angle_y_rad, angle_z_rad, 0, 0, 0);
+    // the vertices are rotated from the rest pose, so that no error is
+    // accumulated, once the level of detail that's drawn is known
+    obj__mesh_move(mesh);
+#endif
+}
+
+void obj_mesh_rotate_to_fixed(mesh_t* mesh, int angle_x, int angle_y, int angle_z) {
+#ifdef INTEGER_ONLY
+    mesh->rotation = vec_mat4i_rotation_fixed(angle_x, angle_y, angle_z, 0, 0, 0);
+#else
+    const float rad_per_step = 2*M_PI/VEC_ANGLE_STEPS;
+    mesh->rotation = vec_mat4_rotation(angle_x*rad_per_step, angle_y*rad_per_step, angle_z*rad_per_step, 0, 0, 0);
+#endif
+    obj__mesh_move(mesh);
+}
+
+void obj_mesh_rotate_to_quat(mesh_t* mesh, const quat_t* quat) {
+#ifdef INTEGER_ONLY
+    // the largest component is scaled to 14 fractional bits, as the sensor's are
+    const float max = UT_MAX(UT_MAX(fabsf(quat->w), fabsf(quat->x)), UT_MAX(fabsf(quat->y), fabsf(quat->z)));
+    const float scale = (1 << 14)/max;
+    const quati_t fixed = {lroundf(quat->w*scale), lroundf(quat->x*scale), lroundf(quat->y*scale),
+                           lroundf(quat->z*scale)};
+    obj_mesh_rotate_to_quat_fixed(mesh, &fixed);
+#else
+    mesh->rotation = vec_mat4_from_quat(quat);
+    obj__mesh_move(mesh);
+#endif
+}
+
+void obj_mesh_rotate_to_quat_fixed(mesh_t* mesh, const quati_t* quat) {
+#ifdef INTEGER_ONLY
+    mesh->rotation = vec_mat4i_from_quat_fixed(quat->w, quat->x, quat->y, quat->z);
+#else
+    const quat_t q = {quat->w, quat->x, quat->y, quat->z};
+    mesh->rotation = vec_mat4_from_quat(&q);
+#endif
+    obj__mesh_move(mesh);
 }
 
 void obj_mesh_translate_by(mesh_t* mesh, float dx, float dy, float dz) {
     vec3i_t translation = {round(dx), round(dy), round(dz)};
     *mesh->center = vec_vec3i_add(mesh->center, &translation);
+    // the rest pose may be shared with instances so it stays where it is
+    mesh->offset = vec_vec3i_add(&mesh->offset, &translation);
+    obj__mesh_move(mesh);
+}
+
+static void obj__mesh_update_faces(mesh_t* mesh) {
+    for (size_t i = 0; i < mesh->n_faces; ++i) {
+        const conn_t* conn = &mesh->connections[i];
+        face_t* face = &mesh->faces[i];
+        face->type = conn->type;
+        face->color = (mesh->color != 0) ? mesh->color : conn->color;
+        face->is_culled = false;
+        // the last index of a triangle is ignored so it may not be a vertex
+        for (int j = 0; j < 4; ++j)
+            face->points[j] = mesh->vertices[conn->indexes[((j < 3) || (face->type == CONNECTION_RECT)) ? j : 0]];
+        // same normal and offset as `obj_plane_set`
+        plane_t plane = {0, &face->normal};
+        obj_plane_set(&plane, &face->points[0], &face->points[1], &face->points[2]);
+        face->offset = plane.offset;
+#ifndef INTEGER_ONLY
+        // only the floating point intersections need it
+        face->inv_normal_z = 1.0/face->normal.z;
+#endif
+        obj_plane_set_depth(&plane, &face->depth);
+        obj_edge_set(&face->edges[0], &face->points[0], &face->points[1]);
+        obj_edge_set(&face->edges[1], &face->points[1], &face->points[2]);
+        obj_edge_set(&face->edges[2], &face->points[2], &face->points[0]);
+        obj_edge_set(&face->edges[3], &face->points[2], &face->points[3]);
+        obj_edge_set(&face->edges[4], &face->points[3], &face->points[0]);
+        const int n_points = (face->type == CONNECTION_RECT) ? 4 : 3;
+        face->xmin = face->xmax = face->points[0].x;
+        face->ymin = face->ymax = face->points[0].y;
+        for (int j = 1; j < n_points; ++j) {
+            face->xmin = UT_MIN(face->xmin, face->points[j].x);
+            face->xmax = UT_MAX(face->xmax, face->points[j].x);
+            face->ymin = UT_MIN(face->ymin, face->points[j].y);
+            face->ymax = UT_MAX(face->ymax, face->points[j].y);
+        }
+    }
+    if (mesh->bvh != NULL)
+        obj_mesh_refit_bvh(mesh);
+}
+
+void obj_mesh_pose(mesh_t* mesh) {
+    if (mesh->is_moved) {
+        obj__mesh_transform(mesh, mesh->vertices_backup, mesh->vertices, mesh->n_vertices);
+        // in a pass of its own, the loop in `obj__mesh_transform` is vectorized without it
+        obj__mesh_update_bbox(mesh);
+        obj__mesh_update_faces(mesh);
+        mesh->is_moved = false;
+    }
+}
+
+void obj_mesh_update_faces(mesh_t* mesh) {
+    // the faces of a mesh that moved are updated along with its vertices
+    if (mesh->is_moved)
+        obj_mesh_pose(mesh);
+    else
+        obj__mesh_update_faces(mesh);
+}
+
+/* twice the center of a face's rectangle along x (axis 0) or y (axis 1) */
+static inline int obj__face_center2(const face_t* face, int axis) {
+    return (axis == 0) ? face->xmin + face->xmax : face->ymin + face->ymax;
+}
+
+/* reorders `ids` so that the k-th face by center along `axis` is at index k,
+ * the ones before it not after it and the ones after it not before it */
+static void obj__bvh_select(size_t* ids, size_t n, size_t k, const face_t* faces, int axis) {
+    ptrdiff_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        const int pivot = obj__face_center2(&faces[ids[lo + (hi - lo)/2]], axis);
+        ptrdiff_t i = lo, j = hi;
+        while (i <= j) {
+            while (obj__face_center2(&faces[ids[i]], axis) < pivot)
+                i++;
+            while (obj__face_center2(&faces[ids[j]], axis) > pivot)
+                j--;
+            if (i <= j) {
+                const size_t tmp = ids[i];
+                ids[i++] = ids[j];
+                ids[j--] = tmp;
+            }
+        }
+        if ((ptrdiff_t)k <= j)
+            hi = j;
+        else if ((ptrdiff_t)k >= i)
+            lo = i;
+        else
+            return;
+    }
+}
+
+/* adds the nodes of faces bvh->faces[first, first + n) and returns the index of
+ * the root of their subtree - splits them by type first, then at the median of
+ * the axis along which their centers spread the most */
+static size_t obj__bvh_build(bvh_t* bvh, const face_t* faces, size_t first, size_t n) {
+    const size_t inode = bvh->n_nodes++;
+    bvh_node_t* node = &bvh->nodes[inode];
+    // faces of different types never share a subtree, so that those found in a
+    // rectangle stay grouped by type - faces are in order until they're split
+    size_t n_split = 1;
+    while ((n_split < n) && (faces[bvh->faces[first + n_split]].type == faces[bvh->faces[first]].type))
+        n_split++;
+    if ((n_split == n) && (n <= OBJ_BVH_LEAF_SIZE)) {
+        node->index = first;
+        node->n_faces = n;
+        node->is_leaf = true;
+        return inode;
+    }
+    if (n_split == n) {
+        int xmin = INT_MAX, ymin = INT_MAX, xmax = INT_MIN, ymax = INT_MIN;
+        for (size_t i = first; i < first + n; ++i) {
+            const face_t* face = &faces[bvh->faces[i]];
+            xmin = UT_MIN(xmin, obj__face_center2(face, 0));
+            xmax = UT_MAX(xmax, obj__face_center2(face, 0));
+            ymin = UT_MIN(ymin, obj__face_center2(face, 1));
+            ymax = UT_MAX(ymax, obj__face_center2(face, 1));
+        }
+        const int axis = (xmax - xmin >= ymax - ymin) ? 0 : 1;
+        obj__bvh_select(&bvh->faces[first], n, n/2, faces, axis);
+        n_split = n/2;
+    }
+    node->n_faces = 0;
+    node->is_leaf = false;
+    obj__bvh_build(bvh, faces, first, n_split);
+    // `bvh->nodes` doesn't move, it has room for all nodes
+    node->index = obj__bvh_build(bvh, faces, first + n_split, n - n_split);
+    return inode;
+}
+
+void obj_mesh_build_bvh(mesh_t* mesh) {
+    // built over the faces where the mesh is
+    obj_mesh_pose(mesh);
+    // the sizes of the arrays only depend on the number of faces, so a
+    // hierarchy that's built again reuses them
+    if (mesh->bvh == NULL) {
+        mesh->bvh = ut_arena_alloc(mesh->arena, sizeof(bvh_t));
+        // a binary tree whose leaves have at least one face has fewer than 2*n_faces nodes
+        mesh->bvh->nodes = ut_arena_alloc(mesh->arena, sizeof(bvh_node_t) * UT_MAX(2*mesh->n_faces, 1));
+        mesh->bvh->faces = ut_arena_alloc(mesh->arena, sizeof(size_t) * mesh->n_faces);
+        mesh->bvh->rects = ut_arena_alloc(mesh->arena, sizeof(rect_t) * mesh->n_faces);
+    }
+    bvh_t* bvh = mesh->bvh;
+    bvh->n_nodes = 0;
+    // no nodes at all for a mesh without faces, not a leaf without any
+    if (mesh->n_faces == 0)
+        return;
+    for (size_t i = 0; i < mesh->n_faces; ++i)
+        bvh->faces[i] = i;
+    obj__bvh_build(bvh, mesh->faces, 0, mesh->n_faces);
+    obj_mesh_refit_bvh(mesh);
+}
+
+/* grows rectangle `a` so that it contains `b` */
+static inline void obj__rect_add(rect_t* a, const rect_t* b) {
+    a->xmin = UT_MIN(a->xmin, b->xmin);
+    a->xmax = UT_MAX(a->xmax, b->xmax);
+    a->ymin = UT_MIN(a->ymin, b->ymin);
+    a->ymax = UT_MAX(a->ymax, b->ymax);
+}
+
+static inline bool obj__rects_overlap(const rect_t* a, const rect_t* b) {
+    return (a->xmin <= b->xmax) && (b->xmin <= a->xmax) && (a->ymin <= b->ymax) && (b->ymin <= a->ymax);
+}
+
+void obj_mesh_refit_bvh(mesh_t* mesh) {
+    bvh_t* bvh = mesh->bvh;
+    for (size_t i = 0; i < mesh->n_faces; ++i) {
+        const face_t* face = &mesh->faces[bvh->faces[i]];
+        bvh->rects[i] = (rect_t) {face->xmin, face->xmax, face->ymin, face->ymax};
+    }
+    // children come after their parent
+    for (size_t inode = bvh->n_nodes; inode-- > 0;) {
+        bvh_node_t* node = &bvh->nodes[inode];
+        node->rect = (rect_t) {INT_MAX, INT_MIN, INT_MAX, INT_MIN};
+        if (!node->is_leaf) {
+            obj__rect_add(&node->rect, &node[1].rect);
+            obj__rect_add(&node->rect, &bvh->nodes[node->index].rect);
+            continue;
+        }
+        for (size_t i = node->index; i < node->index + node->n_faces; ++i)
+            obj__rect_add(&node->rect, &bvh->rects[i]);
+    }
+}
+
+size_t obj_mesh_faces_in_rect(const mesh_t* mesh, int xmin, int ymin, int xmax, int ymax, size_t* faces) {
+    const rect_t rect = {xmin, xmax, ymin, ymax};
+    size_t n_found = 0;
+    // a hierarchy without faces has no root either
+    if (mesh->n_faces == 0)
+        return 0;
+    if (mesh->bvh == NULL) {
+        for (size_t i = 0; i < mesh->n_faces; ++i) {
+            const face_t* face = &mesh->faces[i];
+            const rect_t face_rect = {face->xmin, face->xmax, face->ymin, face->ymax};
+            if (!face->is_culled && obj__rects_overlap(&face_rect, &rect))
+                faces[n_found++] = i;
+        }
+        return n_found;
+    }
+    const bvh_t* bvh = mesh->bvh;
+    // the tree is balanced below a split per type so its depth is about
+    // log2(n_faces/OBJ_BVH_LEAF_SIZE) - the first child is visited first,
+    // which keeps the faces grouped by type
+    size_t stack[64];
+    size_t n_stack = 0;
+    stack[n_stack++] = 0;
+    while (n_stack > 0) {
+        const bvh_node_t* node = &bvh->nodes[stack[--n_stack]];
+        if (!obj__rects_overlap(&node->rect, &rect))
+            continue;
+        if (!node->is_leaf) {
+            stack[n_stack++] = node->index;
+            stack[n_stack++] = node - bvh->nodes + 1;
+            continue;
+        }
+        for (size_t i = node->index; i < node->index + node->n_faces; ++i) {
+            if (obj__rects_overlap(&bvh->rects[i], &rect) && !mesh->faces[bvh->faces[i]].is_culled)
+                faces[n_found++] = bvh->faces[i];
+        }
+    }
+    return n_found;
+}
+
+//----------------------------------------------------------------------------------------------------------
+// Levels of detail
+//----------------------------------------------------------------------------------------------------------
+// triangle of a mesh that's being simplified
+typedef struct lod_tri {
+    int v[3];
+    color_t color;
+} lod_tri_t;
+
+// edge (u, v) with u < v and its squared length
+typedef struct lod_edge {
+    int u, v;
+    long long length2;
+} lod_edge_t;
+
+static int obj__compare_edges(const void* a, const void* b) {
+    const lod_edge_t* ea = a;
+    const lod_edge_t* eb = b;
+    if (ea->length2 != eb->length2)
+        return (ea->length2 > eb->length2) - (ea->length2 < eb->length2);
+    if (ea->u != eb->u)
+        return ea->u - eb->u;
+    return ea->v - eb->v;
+}
+
+/* normal (unnormalized) of triangle (p0, p1, p2), same orientation as `obj_plane_set` */
+static inline void obj__lod_normal(const vec3i_t* p0, const vec3i_t* p1, const vec3i_t* p2, long long* n) {
+    const long long ax = p2->x - p1->x, ay = p2->y - p1->y, az = p2->z - p1->z;
+    const long long bx = p0->x - p1->x, by = p0->y - p1->y, bz = p0->z - p1->z;
+    n[0] = ay*bz - az*by;
+    n[1] = az*bx - ax*bz;
+    n[2] = ax*by - ay*bx;
+}
+
+/* whether moving vertices u and v to `mid` flips triangle `tri` - vertices are
+ * integers so small triangles can be flat (have no normal) before or after */
+static bool obj__lod_flips(const vec3i_t* verts, const lod_tri_t* tri, int u, int v, const vec3i_t* mid) {
+    vec3i_t moved[3];
+    for (int k = 0; k < 3; ++k)
+        moved[k] = ((tri->v[k] == u) || (tri->v[k] == v)) ? *mid : verts[tri->v[k]];
+    long long n_old[3], n_new[3];
+    obj__lod_normal(&verts[tri->v[0]], &verts[tri->v[1]], &verts[tri->v[2]], n_old);
+    obj__lod_normal(&moved[0], &moved[1], &moved[2], n_new);
+    return n_old[0]*n_new[0] + n_old[1]*n_new[1] + n_old[2]*n_new[2] < 0;
+}
+
+/*
+ * Collapses the shortest edges of a triangle mesh, each into its midpoint,
+ * until it has at most `target` triangles or no edge can be collapsed. Each
+ * pass collapses edges from the shortest up, as long as the triangles around
+ * them haven't been touched by another collapse in the same pass and none of
+ * them flips. Returns the number of triangles left at the start of `tris`.
+ */
+static size_t obj__lod_simplify(vec3i_t* verts, size_t n_verts, lod_tri_t* tris, size_t n_tris, size_t target) {
+    lod_edge_t* edges = malloc(sizeof(lod_edge_t) * UT_MAX(3*n_tris, 1));
+    size_t* adj_first = malloc(sizeof(size_t) * (n_verts + 1));
+    size_t* adj = malloc(sizeof(size_t) * UT_MAX(3*n_tris, 1));
+    bool* is_locked = malloc(sizeof(bool) * UT_MAX(n_verts, 1));
+    int* remap = malloc(sizeof(int) * UT_MAX(n_verts, 1));
+    while (n_tris > target) {
+        // unique edges, shortest first
+        size_t n_edges = 0;
+        for (size_t t = 0; t < n_tris; ++t) {
+            for (int k = 0; k < 3; ++k) {
+                const int a = tris[t].v[k], b = tris[t].v[(k + 1) % 3];
+                const vec3i_t d = vec_vec3i_sub(&verts[a], &verts[b]);
+                edges[n_edges++] = (lod_edge_t) {UT_MIN(a, b), UT_MAX(a, b),
+                                                 (long long) d.x*d.x + (long long) d.y*d.y + (long long) d.z*d.z};
+            }
+        }
+        qsort(edges, n_edges, sizeof(lod_edge_t), obj__compare_edges);
+        // triangles around each vertex
+        memset(adj_first, 0, sizeof(size_t) * (n_verts + 1));
+        for (size_t t = 0; t < n_tris; ++t)
+            for (int k = 0; k < 3; ++k)
+                adj_first[tris[t].v[k] + 1]++;
+        for (size_t i = 0; i < n_verts; ++i)
+            adj_first[i + 1] += adj_first[i];
+        for (size_t t = 0; t < n_tris; ++t)
+            for (int k = 0; k < 3; ++k)
+                adj[adj_first[tris[t].v[k]]++] = t;
+        // `adj_first[i]` is now where the triangles of vertex i end
+        for (size_t i = n_verts; i > 0; --i)
+            adj_first[i] = adj_first[i - 1];
+        adj_first[0] = 0;
+        memset(is_locked, 0, sizeof(bool) * n_verts);
+        for (size_t i = 0; i < n_verts; ++i)
+            remap[i] = i;
+
+        size_t n_removed = 0;
+        for (size_t e = 0; (e < n_edges) && (n_tris - n_removed > target); ++e) {
+            const int u = edges[e].u, v = edges[e].v;
+            if ((e > 0) && (edges[e - 1].u == u) && (edges[e - 1].v == v))
+                continue;
+            if (is_locked[u] || is_locked[v])
+                continue;
+            const vec3i_t mid = (vec3i_t) {(verts[u].x + verts[v].x)/2,
+                                           (verts[u].y + verts[v].y)/2,
+                                           (verts[u].z + verts[v].z)/2};
+            // triangles with both u and v disappear, the others must not flip
+            bool flips = false;
+            size_t n_shared = 0;
+            for (int side = 0; side < 2; ++side) {
+                const int w = (side == 0) ? u : v;
+                for (size_t i = adj_first[w]; i < adj_first[w + 1]; ++i) {
+                    const lod_tri_t* tri = &tris[adj[i]];
+                    const bool has_u = (tri->v[0] == u) || (tri->v[1] == u) || (tri->v[2] == u);
+                    const bool has_v = (tri->v[0] == v) || (tri->v[1] == v) || (tri->v[2] == v);
+                    if (has_u && has_v)
+                        n_shared += side == 0;
+                    else
+                        flips |= obj__lod_flips(verts, tri, u, v, &mid);
+                }
+            }
+            if (flips)
+                continue;
+            for (int side = 0; side < 2; ++side) {
+                const int w = (side == 0) ? u : v;
+                for (size_t i = adj_first[w]; i < adj_first[w + 1]; ++i)
+                    for (int k = 0; k < 3; ++k)
+                        is_locked[tris[adj[i]].v[k]] = true;
+            }
+            verts[u] = mid;
+            remap[v] = u;
+            n_removed += n_shared;
+        }
+        // drop the triangles that lost a vertex
+        size_t n_kept = 0;
+        for (size_t t = 0; t < n_tris; ++t) {
+            lod_tri_t tri = tris[t];
+            for (int k = 0; k < 3; ++k)
+                tri.v[k] = remap[tri.v[k]];
+            if ((tri.v[0] != tri.v[1]) && (tri.v[1] != tri.v[2]) && (tri.v[2] != tri.v[0]))
+                tris[n_kept++] = tri;
+        }
+        const bool is_stuck = n_kept == n_tris;
+        n_tris = n_kept;
+        if (is_stuck)
+            break;
+    }
+    free(edges);
+    free(adj_first);
+    free(adj);
+    free(is_locked);
+    free(remap);
+    return n_tris;
+}
+
+/* makes a mesh of the triangles of a level, keeping only the vertices they use */
+static mesh_t* obj__lod_new(const mesh_t* mesh, const vec3i_t* verts, const lod_tri_t* tris, size_t n_tris) {
+    int* index = malloc(sizeof(int) * UT_MAX(mesh->n_vertices, 1));
+    for (size_t i = 0; i < mesh->n_vertices; ++i)
+        index[i] = -1;
+    size_t n_used = 0;
+    for (size_t t = 0; t < n_tris; ++t)
+        for (int k = 0; k < 3; ++k)
+            if (index[tris[t].v[k]] < 0)
+                index[tris[t].v[k]] = n_used++;
+    mesh_t* new = obj__mesh_alloc(n_used, n_tris);
+    new->bounding_box = mesh->bounding_box;
+    new->is_two_sided = mesh->is_two_sided;
+    // levels are built from the rest pose
+    *new->center = vec_vec3i_sub(mesh->center, (vec3i_t*) &mesh->offset);
     for (size_t i = 0; i < mesh->n_vertices; ++i) {
-        *mesh->vertices[i] = vec_vec3i_add(mesh->vertices[i], &translation);
-        *mesh->vertices_backup[i] = vec_vec3i_add(mesh->vertices_backup[i], &translation);
-	}
-    obj__mesh_update_bbox(mesh);
+        if (index[i] < 0)
+            continue;
+        new->vertices[index[i]] = verts[i];
+        new->vertices_backup[index[i]] = verts[i];
+    }
+    for (size_t t = 0; t < n_tris; ++t) {
+        const int i0 = index[tris[t].v[0]], i1 = index[tris[t].v[1]], i2 = index[tris[t].v[2]];
+        new->connections[t] = (conn_t) {{i0, i1, i2, i0}, CONNECTION_TRIANGLE, tris[t].color};
+    }
+    free(index);
+    obj__mesh_update_bbox(new);
+    new->rest_box = new->bounding_box;
+    obj_mesh_update_faces(new);
+    return new;
+}
+
+void obj_mesh_build_lods(mesh_t* mesh, size_t n_levels) {
+    // built once - instances point to the levels of their prototype, which
+    // they have already if this is one, and the arena can't give memory back
+    if (mesh->lods != NULL)
+        return;
+    mesh->lods = ut_arena_alloc(mesh->arena, sizeof(mesh_t*) * n_levels);
+    mesh->n_lods = 0;
+    // the rest pose, split into triangles
+    vec3i_t* verts = malloc(sizeof(vec3i_t) * UT_MAX(mesh->n_vertices, 1));
+    memcpy(verts, mesh->vertices_backup, sizeof(vec3i_t) * mesh->n_vertices);
+    lod_tri_t* tris = malloc(sizeof(lod_tri_t) * UT_MAX(2*mesh->n_faces, 1));
+    size_t n_tris = 0;
+    for (size_t i = 0; i < mesh->n_faces; ++i) {
+        const conn_t* conn = &mesh->connections[i];
+        const uint32_t* v = conn->indexes;
+        tris[n_tris++] = (lod_tri_t) {{v[0], v[1], v[2]}, conn->color};
+        if (conn->type == CONNECTION_RECT)
+            tris[n_tris++] = (lod_tri_t) {{v[0], v[2], v[3]}, conn->color};
+    }
+    // each level carries on collapsing the previous one
+    size_t n_faces = mesh->n_faces;
+    while ((mesh->n_lods < n_levels) && (n_faces/2 >= 4)) {
+        const size_t target = n_faces/2;
+        n_tris = obj__lod_simplify(verts, mesh->n_vertices, tris, n_tris, target);
+        if (n_tris >= n_faces)
+            break;
+        mesh->lods[mesh->n_lods++] = obj__lod_new(mesh, verts, tris, n_tris);
+        n_faces = n_tris;
+        // collapsing got stuck, the next level wouldn't be much coarser
+        if (n_tris > target)
+            break;
+    }
+    free(verts);
+    free(tris);
+}
+
+mesh_t* obj_mesh_lod(mesh_t* mesh, size_t level) {
+    if ((level == 0) || (mesh->n_lods == 0)) {
+        obj_mesh_pose(mesh);
+        return mesh;
+    }
+    mesh_t* lod = mesh->lods[UT_MIN(level, mesh->n_lods) - 1];
+    // move it only if the mesh moved since it was last asked for
+    bool is_moved = !vec_vec3i_are_equal(&lod->offset, &mesh->offset) ||
+                    !vec_vec3i_are_equal(lod->center, mesh->center);
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            is_moved |= lod->rotation.m[i][j] != mesh->rotation.m[i][j];
+    if (is_moved) {
+        lod->offset = mesh->offset;
+        *lod->center = *mesh->center;
+        lod->rotation = mesh->rotation;
+        lod->is_moved = true;
+    }
+    obj_mesh_pose(lod);
+    return lod;
 }
 
 void obj_mesh_free(mesh_t* mesh) {
-    // free the data of the vertices first
-    for (size_t i = 0; i < mesh->n_vertices; ++i) {
-        free(mesh->vertices[i]);
-        free(mesh->vertices_backup[i]);
+    for (size_t i = 0; i < mesh->n_lods; ++i)
+        obj_mesh_free(mesh->lods[i]);
+    // the rest pose and connections of an instance are in its prototype's arena
+    ut_arena_free(mesh->arena);
+}
+
+//----------------------------------------------------------------------------------------------------------
+// Scene
+//----------------------------------------------------------------------------------------------------------
+scene_t* obj_scene_new(size_t capacity) {
+    capacity = UT_MAX(capacity, 1);
+    ut_arena_t* arena = ut_arena_new(ut_arena_size(sizeof(scene_t)) + ut_arena_size(sizeof(mesh_t*) * capacity));
+    scene_t* new = ut_arena_alloc(arena, sizeof(scene_t));
+    new->arena = arena;
+    new->meshes = ut_arena_alloc(arena, sizeof(mesh_t*) * capacity);
+    new->n_meshes = 0;
+    new->capacity = capacity;
+    return new;
+}
+
+void obj_scene_add(scene_t* scene, mesh_t* mesh) {
+    if (scene->n_meshes == scene->capacity) {
+        // the arena can't give the old array back, it goes with the scene
+        mesh_t** meshes = ut_arena_alloc(scene->arena, sizeof(mesh_t*) * 2*scene->capacity);
+        memcpy(meshes, scene->meshes, sizeof(mesh_t*) * scene->n_meshes);
+        scene->meshes = meshes;
+        scene->capacity *= 2;
     }
-    free(mesh->vertices);
-    free(mesh->vertices_backup);
-    for (int i = 0; i < mesh->n_faces; ++i)
-        free(mesh->connections[i]);
-    free(mesh->connections);
-    free(mesh->center);
-    free(mesh);
+    scene->meshes[scene->n_meshes++] = mesh;
+}
+
+void obj_scene_free(scene_t* scene) {
+    for (size_t i = 0; i < scene->n_meshes; ++i)
+        obj_mesh_free(scene->meshes[i]);
+    ut_arena_free(scene->arena);
 }
 
 //----------------------------------------------------------------------------------------------------------
@@ -349,6 +1011,25 @@ void obj_plane_set(plane_t* plane, vec3i_t* p0, vec3i_t* p1, vec3i_t* p2) {
 }
 
 
+void obj_plane_set_depth(plane_t* plane, plane_depth_t* depth) {
+    // solve n.x*x + n.y*y + n.z*z + offset = 0 for z and scale it
+    const int64_t nz = plane->normal->z;
+    if (nz == 0) {
+        *depth = (plane_depth_t) {0, 0, 0};
+        return;
+    }
+    depth->z0 = ut_div_round(-(int64_t)plane->offset*(1 << OBJ_FIXED_BITS), nz);
+    depth->dzdx = ut_div_round(-(int64_t)plane->normal->x*(1 << OBJ_FIXED_BITS), nz);
+    depth->dzdy = ut_div_round(-(int64_t)plane->normal->y*(1 << OBJ_FIXED_BITS), nz);
+}
+
+void obj_edge_set(edge_t* edge, vec3i_t* p, vec3i_t* q) {
+    // (q.x - p.x)*(y - p.y) - (q.y - p.y)*(x - p.x)
+    edge->a = -(q->y - p->y);
+    edge->b = q->x - p->x;
+    edge->c = (q->y - p->y)*p->x - (q->x - p->x)*p->y;
+}
+
 // Whether a point m is inside a triangle (a, b, c)
 bool obj_is_point_in_triangle(vec3i_t* m, vec3i_t* a, vec3i_t* b, vec3i_t* c) {
 /*
@@ -397,17 +1078,22 @@ bool obj_is_point_in_triangle(vec3i_t* m, vec3i_t* a, vec3i_t* b, vec3i_t* c) {
  * .                                               .|      </_/
  * .                                               .|      +
  * .                                               .|      B
+ * A point on an edge (pdot = 0) counts as inside so that faces which share
+ * an edge leave no gap between them. Such points are claimed by both faces
+ * and are drawn by whichever is closer, or the first one cast at the same
+ * depth. The comparisons used to be strict, which dropped pixels along shared
+ * edges once back faces stopped covering them.
  */
     const vec3i_t ma = vec_vec3i_sub(m, a);
     const vec3i_t mb = vec_vec3i_sub(m, b);
     const vec3i_t mc = vec_vec3i_sub(m, c);
     // cw = clockwise, ccw = counter-clockwise
-    const bool are_all_cw =  ((VEC_PERP_DOT_PROD(ma, mb) < 0) &&
-                              (VEC_PERP_DOT_PROD(mb, mc) < 0) &&
-                              (VEC_PERP_DOT_PROD(mc, ma) < 0));
-    const bool are_all_ccw = ((VEC_PERP_DOT_PROD(ma, mb) > 0) &&
-                              (VEC_PERP_DOT_PROD(mb, mc) > 0) &&
-                              (VEC_PERP_DOT_PROD(mc, ma) > 0));
+    const bool are_all_cw =  ((VEC_PERP_DOT_PROD(ma, mb) <= 0) &&
+                              (VEC_PERP_DOT_PROD(mb, mc) <= 0) &&
+                              (VEC_PERP_DOT_PROD(mc, ma) <= 0));
+    const bool are_all_ccw = ((VEC_PERP_DOT_PROD(ma, mb) >= 0) &&
+                              (VEC_PERP_DOT_PROD(mb, mc) >= 0) &&
+                              (VEC_PERP_DOT_PROD(mc, ma) >= 0));
     return are_all_cw || are_all_ccw;
 }
 
@@ -465,28 +1151,332 @@ vec3i_t render__ray_plane_intersection(plane_t* plane, ray_t* ray) {
     return ray_at_intersection;
 }
 
-bool obj_ray_hits_rectangle(ray_t* ray, vec3i_t** points) {
+bool obj_ray_hits_rectangle(ray_t* ray, face_t* face) {
     // find the intersection between the ray and the plane segment
     // defined by p0, p1, p2, p3 and if the intersection is whithin
     // that segment, return true
-    vec3i_t* p0 = points[0];
-    vec3i_t* p1 = points[1];
-    vec3i_t* p2 = points[2];
-    vec3i_t* p3 = points[3];
-    obj_plane_set(g_plane_test, p0, p1, p2);
-    vec3i_t ray_plane_intersection = render__ray_plane_intersection(g_plane_test, ray);
-    return obj_is_point_in_rect(&ray_plane_intersection, p0, p1, p2, p3);
+    // a ray parallel to the plane never meets it
+    if (vec_vec3i_dotprod(&face->normal, ray->end) == 0)
+        return false;
+    plane_t plane = {face->offset, &face->normal};
+    vec3i_t ray_plane_intersection = render__ray_plane_intersection(&plane, ray);
+    // Once rotated, the vertices are rounded so the rectangle isn't exactly one
+    // and `obj_is_point_in_rect` misses slivers along its edges. These used to be
+    // covered by faces at the back but have to be drawn now that these are culled.
+    // Test the two triangles it's split into along the p0-p2 diagonal instead -
+    // they cover the rounded quad exactly and, like all triangle tests, include
+    // their edges. The run tests and `render__face_covers` split it the same way.
+    return obj_is_point_in_triangle(&ray_plane_intersection, &face->points[0], &face->points[1], &face->points[2]) ||
+           obj_is_point_in_triangle(&ray_plane_intersection, &face->points[0], &face->points[2], &face->points[3]);
 }
 
-bool obj_ray_hits_triangle(ray_t* ray, vec3i_t** points) {
+bool obj_ray_hits_triangle(ray_t* ray, face_t* face) {
     // Find the intersection between the ray and the triangle (p0, p1, p2).
     // Return whether the intersection is whithin that triangle
-    vec3i_t* p0 = points[0];
-    vec3i_t* p1 = points[1];
-    vec3i_t* p2 = points[2];
-    obj_plane_set(g_plane_test, p0, p1, p2);
-    vec3i_t ray_plane_intersection = render__ray_plane_intersection(g_plane_test, ray);
-    return obj_is_point_in_triangle(&ray_plane_intersection, p0, p1, p2);
+    if (vec_vec3i_dotprod(&face->normal, ray->end) == 0)
+        return false;
+    plane_t plane = {face->offset, &face->normal};
+    vec3i_t ray_plane_intersection = render__ray_plane_intersection(&plane, ray);
+    return obj_is_point_in_triangle(&ray_plane_intersection, &face->points[0], &face->points[1], &face->points[2]);
+}
+
+/*
+ * Vectorized `obj_ray_hits_rectangle`/`obj_ray_hits_triangle` for a run of
+ * pixels. Each lane repeats the scalar arithmetic step by step, in the same
+ * precision (int, float or double) and the same order, so that the results
+ * are identical:
+ *   z   = round(inv_normal_z*-(n.x*x + n.y*y + offset))  (`face_z_at_xy` in the renderer)
+ *   t0  = |offset/(n.(x, y, z))|                          (`render__ray_plane_intersection`)
+ *   m   = round(t0*(x, y))                                (`vec_vec3i_mul_scalar`)
+ *   hit = n.(x, y, z) != 0 and m is inside (p0, p1, p2) [or (p0, p2, p3)]
+ * Neither SSE2 nor AVX2 can round halves away from zero like `round` does, so
+ * they truncate and step away from zero if the fraction left is at least 1/2.
+ */
+#if defined(__AVX2__)
+static inline __m256i obj__round_ps(__m256 v) {
+    const __m256i t = _mm256_cvttps_epi32(v);
+    const __m256 frac = _mm256_sub_ps(v, _mm256_cvtepi32_ps(t));
+    // compare masks are -1 so subtract them to step up and add them to step down
+    const __m256 up = _mm256_and_ps(_mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ),
+                                    _mm256_cmp_ps(frac, _mm256_set1_ps(1.0f), _CMP_LT_OQ));
+    const __m256 down = _mm256_and_ps(_mm256_cmp_ps(frac, _mm256_set1_ps(-0.5f), _CMP_LE_OQ),
+                                      _mm256_cmp_ps(frac, _mm256_set1_ps(-1.0f), _CMP_GT_OQ));
+    return _mm256_add_epi32(_mm256_sub_epi32(t, _mm256_castps_si256(up)), _mm256_castps_si256(down));
+}
+
+static inline __m128i obj__round_pd(__m256d v) {
+    const __m128i t = _mm256_cvttpd_epi32(v);
+    const __m256d t_pd = _mm256_cvtepi32_pd(t);
+    const __m256d frac = _mm256_sub_pd(v, t_pd);
+    const __m256d up = _mm256_and_pd(_mm256_cmp_pd(frac, _mm256_set1_pd(0.5), _CMP_GE_OQ),
+                                     _mm256_cmp_pd(frac, _mm256_set1_pd(1.0), _CMP_LT_OQ));
+    const __m256d down = _mm256_and_pd(_mm256_cmp_pd(frac, _mm256_set1_pd(-0.5), _CMP_LE_OQ),
+                                       _mm256_cmp_pd(frac, _mm256_set1_pd(-1.0), _CMP_GT_OQ));
+    const __m256d step = _mm256_sub_pd(_mm256_and_pd(up, _mm256_set1_pd(1.0)),
+                                       _mm256_and_pd(down, _mm256_set1_pd(1.0)));
+    return _mm256_cvttpd_epi32(_mm256_add_pd(t_pd, step));
+}
+
+/* mask of the lanes for which m = (mx, my) is inside or on the edges of triangle (a, b, c) */
+static inline __m256i obj__in_triangle(__m256i mx, __m256i my, vec3i_t* a, vec3i_t* b, vec3i_t* c) {
+    const __m256i ma_x = _mm256_sub_epi32(mx, _mm256_set1_epi32(a->x));
+    const __m256i ma_y = _mm256_sub_epi32(my, _mm256_set1_epi32(a->y));
+    const __m256i mb_x = _mm256_sub_epi32(mx, _mm256_set1_epi32(b->x));
+    const __m256i mb_y = _mm256_sub_epi32(my, _mm256_set1_epi32(b->y));
+    const __m256i mc_x = _mm256_sub_epi32(mx, _mm256_set1_epi32(c->x));
+    const __m256i mc_y = _mm256_sub_epi32(my, _mm256_set1_epi32(c->y));
+    const __m256i pdot_ab = _mm256_sub_epi32(_mm256_mullo_epi32(ma_x, mb_y), _mm256_mullo_epi32(ma_y, mb_x));
+    const __m256i pdot_bc = _mm256_sub_epi32(_mm256_mullo_epi32(mb_x, mc_y), _mm256_mullo_epi32(mb_y, mc_x));
+    const __m256i pdot_ca = _mm256_sub_epi32(_mm256_mullo_epi32(mc_x, ma_y), _mm256_mullo_epi32(mc_y, ma_x));
+    const __m256i zero = _mm256_setzero_si256();
+    // inside unless some perp dot products are positive (ccw) and others negative (cw)
+    const __m256i any_ccw = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(pdot_ab, zero),
+                                                            _mm256_cmpgt_epi32(pdot_bc, zero)),
+                                            _mm256_cmpgt_epi32(pdot_ca, zero));
+    const __m256i any_cw = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(zero, pdot_ab),
+                                                           _mm256_cmpgt_epi32(zero, pdot_bc)),
+                                           _mm256_cmpgt_epi32(zero, pdot_ca));
+    return _mm256_andnot_si256(_mm256_and_si256(any_ccw, any_cw), _mm256_set1_epi32(-1));
+}
+
+static inline unsigned obj__ray_hits_run(face_t* face, int x, int y, int* z_hits, bool is_rect) {
+    const __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i ys = _mm256_set1_epi32(y);
+    // depth of the plane under each pixel
+    const __m256i dot_z = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(face->normal.x), xs),
+                                                            _mm256_mullo_epi32(_mm256_set1_epi32(face->normal.y), ys)),
+                                           _mm256_set1_epi32(face->offset));
+    const __m256i neg_dot_z = _mm256_sub_epi32(_mm256_setzero_si256(), dot_z);
+    const __m256d inv_normal_z = _mm256_set1_pd(face->inv_normal_z);
+    const __m128i z_lo = obj__round_pd(_mm256_mul_pd(inv_normal_z, _mm256_cvtepi32_pd(_mm256_castsi256_si128(neg_dot_z))));
+    const __m128i z_hi = obj__round_pd(_mm256_mul_pd(inv_normal_z, _mm256_cvtepi32_pd(_mm256_extracti128_si256(neg_dot_z, 1))));
+    const __m256i zs = _mm256_inserti128_si256(_mm256_castsi128_si256(z_lo), z_hi, 1);
+    _mm256_storeu_si256((__m256i*)z_hits, zs);
+    // where the ray through (x, y, z) meets the plane
+    const __m256i dot_end = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(face->normal.x), xs),
+                                                              _mm256_mullo_epi32(_mm256_set1_epi32(face->normal.y), ys)),
+                                             _mm256_mullo_epi32(_mm256_set1_epi32(face->normal.z), zs));
+    __m256 t0 = _mm256_div_ps(_mm256_set1_ps((float)face->offset), _mm256_cvtepi32_ps(dot_end));
+    t0 = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), t0);
+    const __m256i mx = obj__round_ps(_mm256_mul_ps(t0, _mm256_cvtepi32_ps(xs)));
+    const __m256i my = obj__round_ps(_mm256_mul_ps(t0, _mm256_cvtepi32_ps(ys)));
+    __m256i hits = obj__in_triangle(mx, my, &face->points[0], &face->points[1], &face->points[2]);
+    if (is_rect)
+        hits = _mm256_or_si256(hits, obj__in_triangle(mx, my, &face->points[0], &face->points[2], &face->points[3]));
+    // rays parallel to the plane miss it
+    hits = _mm256_andnot_si256(_mm256_cmpeq_epi32(dot_end, _mm256_setzero_si256()), hits);
+    return _mm256_movemask_ps(_mm256_castsi256_ps(hits));
+}
+#elif defined(__SSE2__)
+/* SSE2 has no 32-bit multiplication that keeps the low half, SSE4.1 does */
+static inline __m128i obj__mullo_epi32(__m128i a, __m128i b) {
+#ifdef __SSE4_1__
+    return _mm_mullo_epi32(a, b);
+#else
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+
+static inline __m128i obj__round_ps(__m128 v) {
+    const __m128i t = _mm_cvttps_epi32(v);
+    const __m128 frac = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+    // compare masks are -1 so subtract them to step up and add them to step down
+    const __m128 up = _mm_and_ps(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)), _mm_cmplt_ps(frac, _mm_set1_ps(1.0f)));
+    const __m128 down = _mm_and_ps(_mm_cmple_ps(frac, _mm_set1_ps(-0.5f)), _mm_cmpgt_ps(frac, _mm_set1_ps(-1.0f)));
+    return _mm_add_epi32(_mm_sub_epi32(t, _mm_castps_si128(up)), _mm_castps_si128(down));
+}
+
+/* rounds two doubles into the low two lanes */
+static inline __m128i obj__round_pd(__m128d v) {
+    const __m128i t = _mm_cvttpd_epi32(v);
+    const __m128d t_pd = _mm_cvtepi32_pd(t);
+    const __m128d frac = _mm_sub_pd(v, t_pd);
+    const __m128d up = _mm_and_pd(_mm_cmpge_pd(frac, _mm_set1_pd(0.5)), _mm_cmplt_pd(frac, _mm_set1_pd(1.0)));
+    const __m128d down = _mm_and_pd(_mm_cmple_pd(frac, _mm_set1_pd(-0.5)), _mm_cmpgt_pd(frac, _mm_set1_pd(-1.0)));
+    const __m128d step = _mm_sub_pd(_mm_and_pd(up, _mm_set1_pd(1.0)), _mm_and_pd(down, _mm_set1_pd(1.0)));
+    return _mm_cvttpd_epi32(_mm_add_pd(t_pd, step));
+}
+
+/* mask of the lanes for which m = (mx, my) is inside or on the edges of triangle (a, b, c) */
+static inline __m128i obj__in_triangle(__m128i mx, __m128i my, vec3i_t* a, vec3i_t* b, vec3i_t* c) {
+    const __m128i ma_x = _mm_sub_epi32(mx, _mm_set1_epi32(a->x));
+    const __m128i ma_y = _mm_sub_epi32(my, _mm_set1_epi32(a->y));
+    const __m128i mb_x = _mm_sub_epi32(mx, _mm_set1_epi32(b->x));
+    const __m128i mb_y = _mm_sub_epi32(my, _mm_set1_epi32(b->y));
+    const __m128i mc_x = _mm_sub_epi32(mx, _mm_set1_epi32(c->x));
+    const __m128i mc_y = _mm_sub_epi32(my, _mm_set1_epi32(c->y));
+    const __m128i pdot_ab = _mm_sub_epi32(obj__mullo_epi32(ma_x, mb_y), obj__mullo_epi32(ma_y, mb_x));
+    const __m128i pdot_bc = _mm_sub_epi32(obj__mullo_epi32(mb_x, mc_y), obj__mullo_epi32(mb_y, mc_x));
+    const __m128i pdot_ca = _mm_sub_epi32(obj__mullo_epi32(mc_x, ma_y), obj__mullo_epi32(mc_y, ma_x));
+    const __m128i zero = _mm_setzero_si128();
+    // inside unless some perp dot products are positive (ccw) and others negative (cw)
+    const __m128i any_ccw = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(pdot_ab, zero),
+                                                      _mm_cmpgt_epi32(pdot_bc, zero)),
+                                         _mm_cmpgt_epi32(pdot_ca, zero));
+    const __m128i any_cw = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi32(pdot_ab, zero),
+                                                     _mm_cmplt_epi32(pdot_bc, zero)),
+                                        _mm_cmplt_epi32(pdot_ca, zero));
+    return _mm_andnot_si128(_mm_and_si128(any_ccw, any_cw), _mm_set1_epi32(-1));
+}
+
+static inline unsigned obj__ray_hits_run(face_t* face, int x, int y, int* z_hits, bool is_rect) {
+    const __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i ys = _mm_set1_epi32(y);
+    // depth of the plane under each pixel
+    const __m128i dot_z = _mm_add_epi32(_mm_add_epi32(obj__mullo_epi32(_mm_set1_epi32(face->normal.x), xs),
+                                                      obj__mullo_epi32(_mm_set1_epi32(face->normal.y), ys)),
+                                        _mm_set1_epi32(face->offset));
+    const __m128i neg_dot_z = _mm_sub_epi32(_mm_setzero_si128(), dot_z);
+    const __m128d inv_normal_z = _mm_set1_pd(face->inv_normal_z);
+    const __m128i z_lo = obj__round_pd(_mm_mul_pd(inv_normal_z, _mm_cvtepi32_pd(neg_dot_z)));
+    const __m128i z_hi = obj__round_pd(_mm_mul_pd(inv_normal_z, _mm_cvtepi32_pd(_mm_srli_si128(neg_dot_z, 8))));
+    const __m128i zs = _mm_unpacklo_epi64(z_lo, z_hi);
+    _mm_storeu_si128((__m128i*)z_hits, zs);
+    // where the ray through (x, y, z) meets the plane
+    const __m128i dot_end = _mm_add_epi32(_mm_add_epi32(obj__mullo_epi32(_mm_set1_epi32(face->normal.x), xs),
+                                                        obj__mullo_epi32(_mm_set1_epi32(face->normal.y), ys)),
+                                          obj__mullo_epi32(_mm_set1_epi32(face->normal.z), zs));
+    __m128 t0 = _mm_div_ps(_mm_set1_ps((float)face->offset), _mm_cvtepi32_ps(dot_end));
+    t0 = _mm_andnot_ps(_mm_set1_ps(-0.0f), t0);
+    const __m128i mx = obj__round_ps(_mm_mul_ps(t0, _mm_cvtepi32_ps(xs)));
+    const __m128i my = obj__round_ps(_mm_mul_ps(t0, _mm_cvtepi32_ps(ys)));
+    __m128i hits = obj__in_triangle(mx, my, &face->points[0], &face->points[1], &face->points[2]);
+    if (is_rect)
+        hits = _mm_or_si128(hits, obj__in_triangle(mx, my, &face->points[0], &face->points[2], &face->points[3]));
+    // rays parallel to the plane miss it
+    hits = _mm_andnot_si128(_mm_cmpeq_epi32(dot_end, _mm_setzero_si128()), hits);
+    return _mm_movemask_ps(_mm_castsi128_ps(hits));
+}
+#elif defined(__ARM_NEON)
+/* mask of the lanes for which m = (mx, my) is inside or on the edges of triangle (a, b, c) */
+static inline uint32x4_t obj__in_triangle(int32x4_t mx, int32x4_t my, vec3i_t* a, vec3i_t* b, vec3i_t* c) {
+    const int32x4_t ma_x = vsubq_s32(mx, vdupq_n_s32(a->x));
+    const int32x4_t ma_y = vsubq_s32(my, vdupq_n_s32(a->y));
+    const int32x4_t mb_x = vsubq_s32(mx, vdupq_n_s32(b->x));
+    const int32x4_t mb_y = vsubq_s32(my, vdupq_n_s32(b->y));
+    const int32x4_t mc_x = vsubq_s32(mx, vdupq_n_s32(c->x));
+    const int32x4_t mc_y = vsubq_s32(my, vdupq_n_s32(c->y));
+    const int32x4_t pdot_ab = vsubq_s32(vmulq_s32(ma_x, mb_y), vmulq_s32(ma_y, mb_x));
+    const int32x4_t pdot_bc = vsubq_s32(vmulq_s32(mb_x, mc_y), vmulq_s32(mb_y, mc_x));
+    const int32x4_t pdot_ca = vsubq_s32(vmulq_s32(mc_x, ma_y), vmulq_s32(mc_y, ma_x));
+    const int32x4_t zero = vdupq_n_s32(0);
+    // inside unless some perp dot products are positive (ccw) and others negative (cw)
+    const uint32x4_t any_ccw = vorrq_u32(vorrq_u32(vcgtq_s32(pdot_ab, zero), vcgtq_s32(pdot_bc, zero)),
+                                         vcgtq_s32(pdot_ca, zero));
+    const uint32x4_t any_cw = vorrq_u32(vorrq_u32(vcltq_s32(pdot_ab, zero), vcltq_s32(pdot_bc, zero)),
+                                        vcltq_s32(pdot_ca, zero));
+    return vmvnq_u32(vandq_u32(any_ccw, any_cw));
+}
+
+#ifdef __aarch64__
+/* rounds (halves away from zero like `round`) and converts two doubles to ints */
+static inline int32x2_t obj__round_f64(float64x2_t v) {
+    return vqmovn_s64(vcvtq_s64_f64(vrndaq_f64(v)));
+}
+
+static inline int32x4_t obj__round_f32(float32x4_t v) {
+    return vcvtq_s32_f32(vrndaq_f32(v));
+}
+
+static inline float32x4_t obj__div_f32(float32x4_t a, float32x4_t b) {
+    return vdivq_f32(a, b);
+}
+
+/* depth of the plane under the pixels whose n.x*x + n.y*y + offset are `dot_z` */
+static inline int32x4_t obj__face_z(face_t* face, int32x4_t dot_z) {
+    const int32x4_t neg_dot_z = vnegq_s32(dot_z);
+    const float64x2_t inv_normal_z = vdupq_n_f64(face->inv_normal_z);
+    const int32x2_t z_lo = obj__round_f64(vmulq_f64(inv_normal_z, vcvtq_f64_s64(vmovl_s32(vget_low_s32(neg_dot_z)))));
+    const int32x2_t z_hi = obj__round_f64(vmulq_f64(inv_normal_z, vcvtq_f64_s64(vmovl_s32(vget_high_s32(neg_dot_z)))));
+    return vcombine_s32(z_lo, z_hi);
+}
+#else
+/*
+ * ARMv7 NEON has no doubles, no rounding instructions and no division. Round
+ * like SSE2 above, take the depths one lane at a time, and divide by an
+ * estimate of the reciprocal refined by two Newton-Raphson steps. That can be
+ * off the quotient in its last bit, so m can differ by one from the scalar
+ * path where t0*x lands on a half.
+ */
+static inline int32x4_t obj__round_f32(float32x4_t v) {
+    const int32x4_t t = vcvtq_s32_f32(v);
+    const float32x4_t frac = vsubq_f32(v, vcvtq_f32_s32(t));
+    // compare masks are -1 so subtract them to step up and add them to step down
+    const uint32x4_t up = vcgeq_f32(frac, vdupq_n_f32(0.5f));
+    const uint32x4_t down = vcleq_f32(frac, vdupq_n_f32(-0.5f));
+    return vaddq_s32(vsubq_s32(t, vreinterpretq_s32_u32(up)), vreinterpretq_s32_u32(down));
+}
+
+static inline float32x4_t obj__div_f32(float32x4_t a, float32x4_t b) {
+    float32x4_t inv_b = vrecpeq_f32(b);
+    inv_b = vmulq_f32(vrecpsq_f32(b, inv_b), inv_b);
+    inv_b = vmulq_f32(vrecpsq_f32(b, inv_b), inv_b);
+    return vmulq_f32(a, inv_b);
+}
+
+/* depth of the plane under the pixels whose n.x*x + n.y*y + offset are `dot_z` */
+static inline int32x4_t obj__face_z(face_t* face, int32x4_t dot_z) {
+    int32_t zs[4];
+    vst1q_s32(zs, dot_z);
+    for (int i = 0; i < 4; ++i)
+        zs[i] = round(face->inv_normal_z*(-zs[i]));
+    return vld1q_s32(zs);
+}
+#endif
+
+static inline unsigned obj__ray_hits_run(face_t* face, int x, int y, int* z_hits, bool is_rect) {
+    const int32_t lanes[4] = {0, 1, 2, 3};
+    const int32x4_t xs = vaddq_s32(vdupq_n_s32(x), vld1q_s32(lanes));
+    const int32x4_t ys = vdupq_n_s32(y);
+    // depth of the plane under each pixel
+    const int32x4_t dot_z = vaddq_s32(vaddq_s32(vmulq_n_s32(xs, face->normal.x), vmulq_n_s32(ys, face->normal.y)),
+                                      vdupq_n_s32(face->offset));
+    const int32x4_t zs = obj__face_z(face, dot_z);
+    vst1q_s32(z_hits, zs);
+    // where the ray through (x, y, z) meets the plane
+    const int32x4_t dot_end = vaddq_s32(vaddq_s32(vmulq_n_s32(xs, face->normal.x), vmulq_n_s32(ys, face->normal.y)),
+                                        vmulq_n_s32(zs, face->normal.z));
+    const float32x4_t t0 = vabsq_f32(obj__div_f32(vdupq_n_f32((float)face->offset), vcvtq_f32_s32(dot_end)));
+    const int32x4_t mx = obj__round_f32(vmulq_f32(t0, vcvtq_f32_s32(xs)));
+    const int32x4_t my = obj__round_f32(vmulq_f32(t0, vcvtq_f32_s32(ys)));
+    uint32x4_t hits = obj__in_triangle(mx, my, &face->points[0], &face->points[1], &face->points[2]);
+    if (is_rect)
+        hits = vorrq_u32(hits, obj__in_triangle(mx, my, &face->points[0], &face->points[2], &face->points[3]));
+    // rays parallel to the plane miss it
+    hits = vbicq_u32(hits, vceqq_s32(dot_end, vdupq_n_s32(0)));
+    // one bit per lane, summed pairwise as ARMv7 can't add across a vector
+    const int32_t bits[4] = {1, 2, 4, 8};
+    const uint32x4_t lane_bits = vandq_u32(hits, vreinterpretq_u32_s32(vld1q_s32(bits)));
+    const uint32x2_t sums = vpadd_u32(vget_low_u32(lane_bits), vget_high_u32(lane_bits));
+    return vget_lane_u32(vpadd_u32(sums, sums), 0);
+}
+#else
+static inline unsigned obj__ray_hits_run(face_t* face, int x, int y, int* z_hits, bool is_rect) {
+    vec3i_t orig = {0, 0, 0}, end;
+    ray_t ray = {&orig, &end};
+    unsigned hits = 0;
+    for (int i = 0; i < OBJ_RUN_LENGTH; ++i) {
+        vec3i_t coeffs = (vec3i_t) {face->normal.x, face->normal.y, face->offset};
+        vec3i_t xyz = (vec3i_t) {x + i, y, 1};
+        z_hits[i] = round(face->inv_normal_z*(-vec_vec3i_dotprod(&coeffs, &xyz)));
+        obj_ray_send(&ray, x + i, y, z_hits[i]);
+        const bool is_hit = (is_rect) ? obj_ray_hits_rectangle(&ray, face) : obj_ray_hits_triangle(&ray, face);
+        hits |= is_hit << i;
+    }
+    return hits;
+}
+#endif
+
+// one run test per type so that `is_rect` is a constant in each
+unsigned obj_ray_hits_rectangle_run(face_t* face, int x, int y, int* z_hits) {
+    return obj__ray_hits_run(face, x, y, z_hits, true);
+}
+
+unsigned obj_ray_hits_triangle_run(face_t* face, int x, int y, int* z_hits) {
+    return obj__ray_hits_run(face, x, y, z_hits, false);
 }
 
 
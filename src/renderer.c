@@ -7,34 +7,216 @@
 #include <stdlib.h> // malloc, free
 #include <string.h> // memset
 #include <limits.h> // INT_MAX, INT_MIN
+#include <pthread.h> // pthread_create, pthread_join
+
+
+// size of the tiles the screen is split into when rendering with several threads
+#define RENDER_TILE_ROWS 8
+#define RENDER_TILE_COLS 32
+// size (rows and columns) of the blocks of the coarse depth buffer - tiles are
+// made of whole blocks so each block is only written by one thread at a time
+#define RENDER_BLOCK_SIZE 8
+// floating point ray-plane intersections are rounded so a ray can hit a face up
+// to this many pixels outside of its bounding rectangle
+#define RENDER_RECT_MARGIN 1
+// the coarsest level of detail of a mesh is drawn that still has this many faces
+// per cell of the screen its bounding box covers - about half of the faces face
+// away from the camera so the others get two cells each
+#define RENDER_LOD_FACES_PER_CELL 1
+// with perspective, the depth of the near plane of the view frustum - points
+// closer to the camera plane than this are clipped
+#define RENDER_NEAR 1
+// with perspective, the depth buffer holds -RENDER_DEPTH_SCALE/z, which (unlike
+// z) is linear in screen space and still smaller for nearer points
+#define RENDER_DEPTH_SCALE (1 << 24)
+// most points of a face clipped by the view frustum - each of its 5 planes
+// adds at most one point to a triangle or rectangle
+#define RENDER_MAX_POINTS 9
+// planes of the view frustum a point can be outside of, see `render__outcode`
+#define RENDER_OUT_NEAR   1
+#define RENDER_OUT_LEFT   2
+#define RENDER_OUT_RIGHT  4
+#define RENDER_OUT_TOP    8
+#define RENDER_OUT_BOTTOM 16
+// shapes with more faces than this are all reflected with the middle color,
+// since `g_colors_refl` has fewer colors than the bins the angle falls in
+#define RENDER_REFL_MAX_FACES 16
+// edge cells are sampled at a grid of between 2 by 2 and 4 by 4 points
+#define RENDER_MIN_SUPERSAMPLES 2
+#define RENDER_MAX_SUPERSAMPLES 4
 
 
 #define VEC_MAGN_SQUARED(vec) vec->x*vec->x + vec->y*vec->y + vec->z*vec->z
 #define VEC_PERP_DOT_PROD(a, b) a.x*b.y - a.y*b.x
 
+#ifdef INTEGER_ONLY
+// the coefficients of the projection are integers so clip coordinates are too,
+// as are (in 64 bits) their distances to the planes of the view frustum
+typedef vec4i_t clip_t;
+typedef mat4i_t clip_mat_t;
+typedef int64_t clip_dist_t;
+#else
+typedef vec4_t clip_t;
+typedef mat4_t clip_mat_t;
+typedef float clip_dist_t;
+#endif
+
 
 bool g_use_perspective = false;
 bool g_use_reflectance = false;
+bool g_use_rasterizer = false;
+#ifdef INTEGER_ONLY
+// coverage and depth have no floating point version
+bool g_use_fixed_point = true;
+#else
+bool g_use_fixed_point = false;
+#endif
+unsigned g_render_threads = 1;
+// samples per edge cell, 0 to not supersample
+unsigned g_render_supersamples = 0;
 int* g_z_buffer;
-vec3i_t** g_surf_points;
-// defines a plane each time we're about to hit a pixel
-plane_t* g_plane_test;
-ray_t* g_ray_test;
+// frame (generation) each entry of `g_z_buffer` was last written in - entries of
+// earlier frames are stale and count as empty, so the buffer is cleared by
+// moving on to the next generation rather than by writing to all of it
+static unsigned char* g_z_generations;
+static unsigned char g_z_generation;
+// face each pixel of `g_z_buffer` was written from, only kept when supersampling
+static const face_t** g_face_ids;
+// indexes of the cells on the edges of faces and of the faces that may cover
+// one of them, see `render__refine_edges`
+static size_t* g_edge_cells;
+static size_t* g_cell_faces;
+static size_t g_cell_faces_capacity;
 // camera where rays are shot from 
 camera_t g_camera;
 // stores the colors of a surfaces after it reflects light - from brightest to darkest
 color_t g_colors_refl[32];
-// expand the second column of `CONN_TABLE`, mapping connections
-// to intersection functions in an 1-1 manner
-bool (*func_table_intersection[NUM_CONNECTIONS])(ray_t* ray, vec3i_t** points) = {
-#define X(a, b, c) c,
-    CONN_TABLE
-#undef X
-};
+// index of `g_colors_refl` by number of faces of a shape (up to one more than
+// `RENDER_REFL_MAX_FACES`) and bin of the angle a face reflects light at
+static unsigned char g_refl_lut[RENDER_REFL_MAX_FACES + 2][2*RENDER_REFL_MAX_FACES + 1];
+// model-view-projection transform from world to clip coordinates - the model
+// transform is the identity since meshes keep their vertices in world
+// coordinates (see `obj_mesh_rotate_to`)
+static clip_mat_t g_view_proj;
+#ifdef INTEGER_ONLY
+// |focal_length| of the camera, rounded
+static int g_focal_length;
+#endif
+
+// vertex of the shapes that are being rasterized after the per-vertex stage
+typedef struct raster_vertex {
+    clip_t clip;
+    // planes of the view frustum the vertex is outside of
+    unsigned outcode;
+    // screen coordinates, set if the vertex isn't outside of any of them
+    vec3i_t screen;
+} raster_vertex_t;
+static raster_vertex_t* g_proj_vertices;
+static size_t g_proj_capacity;
+
+// screen-space setup of a face of the shape that is being rasterized
+typedef struct raster_face {
+    // projected (and clipped) polygon, drawn as a fan of triangles around points[0]
+    vec3i_t points[RENDER_MAX_POINTS];
+    int n_points;
+    // plane through the projected vertices - `plane.normal` points to `normal`
+    plane_t plane;
+    vec3i_t normal;
+    // the plane's depth in fixed point, if it's used
+    plane_depth_t depth;
+    color_t color;
+    // face of the mesh it's set up from
+    const face_t* face;
+    // bounding rectangle of the points, clipped to the screen
+    rect_t rect;
+} raster_face_t;
+static raster_face_t* g_raster_faces;
+static size_t g_raster_capacity;
+
+/*
+ * Coarse depth buffer, i.e. the range of depths in a block of the screen. A
+ * face that's behind the furthest pixel of a block can skip all of its
+ * pixels there. Pixels are only ever written closer so `z_min` is kept up to
+ * date as they are, whereas `z_max` is recomputed when it's next needed.
+ */
+typedef struct depth_block {
+    int z_min;
+    int z_max;
+    bool is_max_stale;
+} depth_block_t;
+static depth_block_t* g_depth_blocks;
+static size_t g_n_depth_blocks;
+static int g_depth_blocks_per_row;
+
+/*
+ * Rectangle of the screen that's drawn by one thread at a time. Tiles don't
+ * overlap so threads write to the screen and depth buffers without locks.
+ */
+typedef struct tile {
+    // rows [row0, row1) and columns [col0, col1) of the terminal
+    int row0, row1;
+    int col0, col1;
+    // the same area in screen coordinates (inclusive)
+    int xmin, xmax;
+    int ymin, ymax;
+    // faces (indexes) to rasterize in this tile in ascending order or, when
+    // casting rays, those that may be hit on the current row
+    size_t* faces;
+    size_t n_faces;
+} tile_t;
+static tile_t* g_tiles;
+static size_t g_n_tiles;
+// the whole screen as one tile, which a single thread casts rays into
+static tile_t g_screen_tile;
+// tiles per row of tiles and size of each tile
+static int g_tiles_per_row;
+static int g_tile_rows;
+static int g_tile_cols;
+static size_t g_bin_capacity;
+// shapes of a scene that are on the screen, see `render_write_scene`
+static mesh_t** g_queue;
+static size_t g_queue_capacity;
+
+// thread pool - workers wait for `g_pool_frame` to change and then draw tiles
+// until there are none left, together with the thread that called the renderer
+static pthread_t* g_pool_threads;
+static pthread_mutex_t g_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned g_pool_frame;
+static unsigned g_pool_busy;
+static bool g_pool_quit;
+// shapes drawn in the current frame, nearest first
+static mesh_t** g_pool_shapes;
+static size_t g_pool_n_shapes;
+static size_t g_pool_next_item;
+static size_t g_pool_n_items;
 
 //------------------------------------------------------------------------------------
 // Static functions
 //------------------------------------------------------------------------------------
+/* expands the second and third columns of `CONN_TABLE`, mapping connections to
+ * intersection functions - `type` is that of a whole range of faces (see
+ * `render__raycast_faces`), so the switch is resolved once per range */
+static inline bool render__ray_hits_face(ray_t* ray, face_t* face, int type) {
+    switch (type) {
+#define X(a, b, c, d) case b: return c(ray, face);
+    CONN_TABLE
+#undef X
+    }
+    return false;
+}
+
+/* same as `render__ray_hits_face` for runs of pixels, from the last column */
+static inline unsigned render__ray_hits_face_run(face_t* face, int x, int y, int* z_hits, int type) {
+    switch (type) {
+#define X(a, b, c, d) case b: return d(face, x, y, z_hits);
+    CONN_TABLE
+#undef X
+    }
+    return 0;
+}
+
 static inline float render__cosine_squared(vec3i_t* vec1, vec3i_t* vec2) {
     const unsigned m1 = vec1->x*vec1->x + vec1->y*vec1->y + vec1->z*vec1->z;
     const unsigned m2 = vec2->x*vec2->x + vec2->y*vec2->y + vec2->z*vec2->z;
@@ -42,6 +224,26 @@ static inline float render__cosine_squared(vec3i_t* vec1, vec3i_t* vec2) {
            ((float)m1*m2);
 }
 
+/* halves a vector until its coordinates are below 2^14, which barely changes its direction */
+static inline vec3i_t render__shrink(vec3i_t vec) {
+    while ((abs(vec.x) >= (1 << 14)) || (abs(vec.y) >= (1 << 14)) || (abs(vec.z) >= (1 << 14)))
+        vec = (vec3i_t) {vec.x/2, vec.y/2, vec.z/2};
+    return vec;
+}
+
+/* integer version of `render__cosine_squared`, in fixed point */
+static inline int64_t render__cosine_squared_fixed(vec3i_t* vec1, vec3i_t* vec2) {
+    // the squares of shrunk vectors fit in 64 bits
+    vec3i_t a = render__shrink(*vec1), b = render__shrink(*vec2);
+    const int64_t dot = vec_vec3i_dotprod(&a, &b);
+    const int64_t m = (int64_t) vec_vec3i_dotprod(&a, &a)*vec_vec3i_dotprod(&b, &b);
+    if (m == 0)
+        return 0;
+    if (m < ((int64_t) 1 << 40))
+        return (dot*dot << OBJ_FIXED_BITS)/m;
+    return dot*dot/(m >> OBJ_FIXED_BITS);
+}
+
 
 /* find the z-coordinate on a plane given x and y */
 static inline int plane_z_at_xy(plane_t* plane, int x, int y) {
@@ -51,35 +253,303 @@ static inline int plane_z_at_xy(plane_t* plane, int x, int y) {
     return round(1.0/plane->normal->z*(-vec_vec3i_dotprod(&coeffs, &xyz)));
 }
 
+/* same as `plane_z_at_xy` for the plane of a face, whose 1/normal.z is precomputed */
+static inline int face_z_at_xy(face_t* face, int x, int y) {
+    vec3i_t coeffs = (vec3i_t) {face->normal.x, face->normal.y, face->offset};
+    vec3i_t xyz = (vec3i_t) {x, y, 1};
+    return round(face->inv_normal_z*(-vec_vec3i_dotprod(&coeffs, &xyz)));
+}
+
+/* rounds a fixed-point depth to the nearest integer */
+static inline int render__round_fixed(int64_t z) {
+    return (z + (1 << (OBJ_FIXED_BITS - 1))) >> OBJ_FIXED_BITS;
+}
+
+/* fixed-point depth of a plane at (x, y), see `plane_depth_t` */
+static inline int64_t render__depth_at(plane_depth_t* depth, int x, int y) {
+    return depth->z0 + depth->dzdx*x + depth->dzdy*y;
+}
+
+static inline int render__edge_at(edge_t* edge, int x, int y) {
+    return edge->a*x + edge->b*y + edge->c;
+}
+
+/* whether a point is inside (or on an edge of) a triangle given its edge functions there */
+static inline bool render__is_inside(int e0, int e1, int e2) {
+    return ((e0 >= 0) && (e1 >= 0) && (e2 >= 0)) ||
+           ((e0 <= 0) && (e1 <= 0) && (e2 <= 0));
+}
 
-/* perspective trasnform to map world point (3D) to screen (2D) */
-static inline vec3i_t render__persp_transform(vec3i_t* xyz) {
-    // to avoid drawing inverted images
-    int sign = (xyz->z > 0) ? -1 : 1;
-    return (vec3i_t) {UT_CLIP(sign*xyz->x*g_camera.focal_length/(xyz->z + 1e-8), -g_cols/2, g_cols/2),
-                      UT_CLIP(sign*xyz->y*g_camera.focal_length/(xyz->z + 1e-8), -g_rows, g_rows),
-                      xyz->z};
+/* integer version of the intersection functions - whether (x, y) is inside the
+ * face of type `type` projected on the xy plane, given its edge functions `e` at (x, y) */
+static inline bool render__face_covers(face_t* face, int* e, int type) {
+    // faces seen edge-on have no depth (see `obj_plane_set_depth`)
+    if (face->normal.z == 0)
+        return false;
+    // the diagonal p0p2 of rectangles is the edge p2p0 reversed
+    return render__is_inside(e[0], e[1], e[2]) ||
+           ((type == CONNECTION_RECT) && render__is_inside(-e[2], e[3], e[4]));
 }
 
+/* depth of a face at (x, y) as computed by the ray caster */
+static inline int render__face_z_at_xy(face_t* face, int x, int y) {
+    return (g_use_fixed_point) ? render__round_fixed(render__depth_at(&face->depth, x, y)) :
+                                 face_z_at_xy(face, x, y);
+}
+
+/*
+ * Fixed-point version of `render__ray_hits_face_run` - the edge functions and
+ * depth are evaluated at the first pixel of the run and then stepped along it.
+ */
+static inline unsigned render__face_covers_run(face_t* face, int x, int y, int* z_hits, int type) {
+    int e[5];
+    for (int k = 0; k < 5; ++k)
+        e[k] = render__edge_at(&face->edges[k], x, y);
+    int64_t z = render__depth_at(&face->depth, x, y);
+    unsigned hits = 0;
+    for (int i = 0; i < OBJ_RUN_LENGTH; ++i) {
+        z_hits[i] = render__round_fixed(z);
+        hits |= render__face_covers(face, e, type) << i;
+        z += face->depth.dzdx;
+        for (int k = 0; k < 5; ++k)
+            e[k] += face->edges[k].a;
+    }
+    return hits;
+}
+
+
 /**
-* @brief Returns a color based on the angle between the ray and plane,
+ * @brief Sets up the transform from world to clip coordinates. The view looks
+ *        down +z from the camera, with y flipped to avoid drawing inverted
+ *        images. Without perspective, clip coordinates are screen coordinates
+ *        and w is 1. With it, w is the depth z of the point and it lands on
+ *        the screen at (x/w, y/w) = |focal_length|*(x, y)/z, a pinhole camera.
+ */
+static void render__set_view_proj() {
+    const mat4_t model = vec_mat4_identity();
+    const mat4_t view = (mat4_t) {{{1,  0, 0, -g_camera.x0},
+                                   {0, -1, 0,  g_camera.y0},
+                                   {0,  0, 1,  0},
+                                   {0,  0, 0,  1}}};
+    const float f = fabs(g_camera.focal_length);
+    // clip z keeps the depth in view space, w is the divisor of the projection
+    const mat4_t proj = (g_use_perspective) ? (mat4_t) {{{f, 0, 0, 0},
+                                                        {0, f, 0, 0},
+                                                        {0, 0, 1, 0},
+                                                        {0, 0, 1, 0}}}
+                                            : vec_mat4_identity();
+    const mat4_t view_model = vec_mat4_mul(&view, &model);
+    const mat4_t view_proj = vec_mat4_mul(&proj, &view_model);
+#ifdef INTEGER_ONLY
+    g_view_proj = vec_mat4_round(&view_proj);
+    g_focal_length = lround(f);
+#else
+    g_view_proj = view_proj;
+#endif
+}
+
+/* clip coordinates of a point in world coordinates */
+static inline clip_t render__world2clip(const vec3i_t* point) {
+#ifdef INTEGER_ONLY
+    return vec_mat4i_apply(&g_view_proj, point);
+#else
+    return vec_mat4_apply(&g_view_proj, point);
+#endif
+}
+
+#ifdef INTEGER_ONLY
+/* a + t*(b - a) for a fixed-point t */
+static inline int render__lerp(int a, int b, int64_t t) {
+    return a + (((b - a)*t + (1 << (OBJ_FIXED_BITS - 1))) >> OBJ_FIXED_BITS);
+}
+#endif
+
+/* signed distance of a point in clip coordinates to a plane of the view frustum
+ * (up to a factor), non-negative inside of it and linear along a segment */
+static inline clip_dist_t render__plane_dist(const clip_t* clip, unsigned plane) {
+    int xmin, ymin, xmax, ymax;
+    screen_get_bounds(&xmin, &ymin, &xmax, &ymax);
+    // the sides are a pixel past the screen so that clipped edges aren't drawn
+    switch (plane) {
+        case RENDER_OUT_NEAR:  return (clip_dist_t) clip->w - RENDER_NEAR;
+        case RENDER_OUT_LEFT:  return clip->x - (clip_dist_t) (xmin - 1)*clip->w;
+        case RENDER_OUT_RIGHT: return (clip_dist_t) (xmax + 1)*clip->w - clip->x;
+        case RENDER_OUT_TOP:   return clip->y - (clip_dist_t) (ymin - 1)*clip->w;
+        default:               return (clip_dist_t) (ymax + 1)*clip->w - clip->y;
+    }
+}
+
+/**
+ * @brief Finds the planes of the view frustum a point is outside of. The frustum
+ *        is bounded by the near plane and the sides of the screen. There's no
+ *        far plane since the depth of far points stays bounded.
+ *
+ * @param clip Point in clip coordinates
+ *
+ * @return A mask of `RENDER_OUT_*` flags, 0 if it's inside of the frustum
+ */
+static inline unsigned render__outcode(const clip_t* clip) {
+    unsigned outcode = 0;
+    for (unsigned plane = RENDER_OUT_NEAR; plane <= RENDER_OUT_BOTTOM; plane <<= 1)
+        if (render__plane_dist(clip, plane) < 0)
+            outcode |= plane;
+    return outcode;
+}
+
+/**
+ * @brief Clips a polygon against the planes of the view frustum one after the
+ *        other (Sutherland-Hodgman), keeping the part inside of it
+ *
+ * @param[in/out] points   Points of the polygon in clip coordinates, with room
+ *                         for `RENDER_MAX_POINTS`
+ * @param[in]     n_points Number of points of the polygon
+ * @param[in]     outcode  Planes that any of its points is outside of
+ *
+ * @return Number of points of the clipped polygon, less than 3 if nothing is left
+ */
+static int render__clip_polygon(clip_t* points, int n_points, unsigned outcode) {
+    clip_t clipped[RENDER_MAX_POINTS];
+    for (unsigned plane = RENDER_OUT_NEAR; (plane <= RENDER_OUT_BOTTOM) && (n_points >= 3); plane <<= 1) {
+        if (!(outcode & plane))
+            continue;
+        int n_clipped = 0;
+        for (int i = 0; i < n_points; ++i) {
+            const clip_t* p = &points[i];
+            const clip_t* q = &points[(i + 1) % n_points];
+            const clip_dist_t d_p = render__plane_dist(p, plane);
+            const clip_dist_t d_q = render__plane_dist(q, plane);
+            if (d_p >= 0)
+                clipped[n_clipped++] = *p;
+            // pq crosses the plane
+            if ((d_p >= 0) != (d_q >= 0)) {
+#ifdef INTEGER_ONLY
+                const int64_t t = ut_div_round(d_p*(1 << OBJ_FIXED_BITS), d_p - d_q);
+                clipped[n_clipped++] = (clip_t) {render__lerp(p->x, q->x, t), render__lerp(p->y, q->y, t),
+                                                 render__lerp(p->z, q->z, t), render__lerp(p->w, q->w, t)};
+#else
+                const float t = d_p/(d_p - d_q);
+                clipped[n_clipped++] = (clip_t) {p->x + t*(q->x - p->x), p->y + t*(q->y - p->y),
+                                                 p->z + t*(q->z - p->z), p->w + t*(q->w - p->w)};
+#endif
+            }
+        }
+        n_points = n_clipped;
+        memcpy(points, clipped, sizeof(clip_t) * n_points);
+    }
+    return n_points;
+}
+
+/* screen coordinates of a point in clip coordinates - with perspective its
+ * depth is set per face, see `render__set_persp_depth` */
+static inline vec3i_t render__clip2screen(const clip_t* clip) {
+    if (!g_use_perspective)
+        return (vec3i_t) {clip->x, clip->y, clip->z};
+#ifdef INTEGER_ONLY
+    return (vec3i_t) {ut_div_round(clip->x, clip->w), ut_div_round(clip->y, clip->w), 0};
+#else
+    return (vec3i_t) {round(clip->x/clip->w), round(clip->y/clip->w), 0};
+#endif
+}
+
+/**
+ * @brief Sets the fixed-point depth of a face with perspective. It's -RENDER_DEPTH_SCALE/z,
+ *        since the ray from the eye E through screen point (x, y) is E + z*(x/f, -y/f, 1)
+ *        and meets the plane n.X + offset = 0 of the face at
+ *        1/z = -(n.x*x/f - n.y*y/f + n.z)/(n.E + offset), which is linear in x and y.
+ *
+ * @param[in]  face  Pointer to the face, in world coordinates
+ * @param[out] depth Fixed-point depth of the face, see `plane_depth_t`
+ *
+ * @return false if the face's plane goes through the eye, i.e. it's seen edge-on
+ */
+static bool render__set_persp_depth(const face_t* face, plane_depth_t* depth) {
+#ifdef INTEGER_ONLY
+    const int64_t offset = (int64_t) face->normal.x*g_camera.x0 + (int64_t) face->normal.y*g_camera.y0 + face->offset;
+    if (offset == 0)
+        return false;
+    // divided by the offset first so that it's multiplied by the normal in 64 bits
+    const int64_t scale = ut_div_round((int64_t) RENDER_DEPTH_SCALE << OBJ_FIXED_BITS, offset);
+    depth->dzdx = ut_div_round(scale*face->normal.x, g_focal_length);
+    depth->dzdy = ut_div_round(-scale*face->normal.y, g_focal_length);
+    depth->z0 = scale*face->normal.z;
+    return true;
+#else
+    const double offset = (double) face->normal.x*g_camera.x0 + (double) face->normal.y*g_camera.y0 + face->offset;
+    if (offset == 0)
+        return false;
+    const double f = fabs(g_camera.focal_length);
+    const double scale = (double) RENDER_DEPTH_SCALE*(1 << OBJ_FIXED_BITS)/offset;
+    depth->dzdx = llround(scale*face->normal.x/f);
+    depth->dzdy = llround(-scale*face->normal.y/f);
+    depth->z0 = llround(scale*face->normal.z);
+    return true;
+#endif
+}
+
+/**
+* @brief Finds the rectangle of the screen that the bounding box of a shape
+*        covers - the projection of its corners with perspective
+*
+* @param[in] shape Pointer to the shape
+* @param[out] xmin, ymin, xmax, ymax Bounds of the rectangle in screen coordinates
+*
+* @returns false if the box crosses the near plane and can't be projected
+*/
+static bool render__shape_screen_rect(const mesh_t* shape, int* xmin, int* ymin, int* xmax, int* ymax) {
+    const struct bounding_box* bbox = &shape->bounding_box;
+    if (!g_use_perspective) {
+        // -y to avoid drawing inverted images
+        *xmin = bbox->x0, *xmax = bbox->x1;
+        *ymin = -bbox->y1, *ymax = -bbox->y0;
+        return true;
+    }
+    if (bbox->z0 < RENDER_NEAR)
+        return false;
+    *xmin = *ymin = INT_MAX;
+    *xmax = *ymax = INT_MIN;
+    for (int i = 0; i < 8; ++i) {
+        const vec3i_t corner = (vec3i_t) {(i & 1) ? bbox->x1 : bbox->x0,
+                                          (i & 2) ? bbox->y1 : bbox->y0,
+                                          (i & 4) ? bbox->z1 : bbox->z0};
+        const clip_t clip = render__world2clip(&corner);
+        const vec3i_t point = render__clip2screen(&clip);
+        *xmin = UT_MIN(*xmin, point.x);
+        *ymin = UT_MIN(*ymin, point.y);
+        *xmax = UT_MAX(*xmax, point.x);
+        *ymax = UT_MAX(*ymax, point.y);
+    }
+    return true;
+}
+
+/**
+ * @brief Fills the table of reflected colors, see `render__reflect`
+ */
+static void render__init_refl_lut() {
+    for (size_t n_faces = 1; n_faces <= RENDER_REFL_MAX_FACES + 1; ++n_faces) {
+        const size_t n = 2*n_faces;
+        const size_t w_c = 32/n;
+        for (size_t i_angle = 0; i_angle <= 2*RENDER_REFL_MAX_FACES; ++i_angle)
+            g_refl_lut[n_faces][i_angle] = UT_MIN((32 % n)/2 + w_c/2 + i_angle*w_c, 31);
+    }
+}
+
+/**
+* @brief Returns a color based on the angle between the camera and a plane,
 *        simulating reflection
 *
-* @param[in] ray A pointer to ray
-* @param[in] plane A pointer to plane
+* @param[in] normal A pointer to the normal vector of the plane
 * @param[in] shape A pointer to shape
 *
 * @returns Reflected color
 */
-static inline color_t render__reflect(ray_t* ray, plane_t* plane, mesh_t* shape) {
+static color_t render__reflect(vec3i_t* normal, mesh_t* shape) {
     const int z_refl = (g_use_perspective) ? g_camera.focal_length : -shape->center->z/2;
     vec3i_t camera_axis = {g_camera.x0,
                             g_camera.y0,
                             z_refl};
-    const vec3i_t plane_normal = *plane->normal;
+    const vec3i_t plane_normal = *normal;
     const int ray_angle_ccw = VEC_PERP_DOT_PROD(camera_axis, plane_normal);
     const int sign = (ray_angle_ccw > 0) ? 1 : -1;
-    const float ray_plane_angle = sign*render__cosine_squared(&camera_axis, plane->normal);
     //-----------------------------------------------------
     // reflectance
     /*
@@ -104,18 +574,200 @@ static inline color_t render__reflect(ray_t* ray, plane_t* plane, mesh_t* shape)
      * w_c = floor(32/n)
      * i_color_start = (32 - (32 mod n))/2 + w_c/2
      * i_color = i_color_start + i_angle * wc
+     *
+     * i_color is looked up in `g_refl_lut`, only i_angle depends on the face
      */
     const int n = 2*shape->n_faces;
+#ifdef INTEGER_ONLY
+    // (angle + 1)/w_a = (angle + 1)*n/2
+    const int64_t ray_plane_angle = sign*render__cosine_squared_fixed(&camera_axis, normal);
+    const size_t i_angle = ((ray_plane_angle + (1 << OBJ_FIXED_BITS))*n/2) >> OBJ_FIXED_BITS;
+#else
+    const float ray_plane_angle = sign*render__cosine_squared(&camera_axis, normal);
     const float w_a = 2.0/n; 
-    const size_t w_c = 32/n;
-    return g_colors_refl[(size_t)(
-                         (32 % n)/2 + w_c/2 +
-                         (size_t)((ray_plane_angle+1)/w_a)*w_c)];
+    const size_t i_angle = (ray_plane_angle + 1)/w_a;
+#endif
+    return g_colors_refl[g_refl_lut[UT_MIN(shape->n_faces, RENDER_REFL_MAX_FACES + 1)]
+                                   [UT_MIN(i_angle, 2*RENDER_REFL_MAX_FACES)]];
+}
+
+/**
+ * @brief Sets the color each face that's not culled is drawn with in this frame,
+ *        so that it's not recomputed for each pixel
+ *
+ * @param[in/out] shape Pointer to the shape whose faces to shade
+ */
+static void render__shade_faces(mesh_t* shape) {
+    for (size_t isurf = 0; isurf < shape->n_faces; ++isurf) {
+        face_t* face = &shape->faces[isurf];
+        if (!face->is_culled)
+            face->shade = (g_use_reflectance) ? render__reflect(&face->normal, shape) : face->color;
+    }
+}
+
+/**
+ * @brief Marks the faces of a one-sided mesh that point away from the camera
+ *        as culled so that no pixel is tested against them. A face points away
+ *        when its (outward) normal makes an acute angle with the direction
+ *        we look at it from: +z for the orthographic view, the direction from
+ *        the centre of projection to the face for the perspective one.
+ *
+ * @param[in/out] shape Pointer to the shape whose faces to cull
+ */
+static void render__cull_faces(mesh_t* shape) {
+    const vec3i_t eye = (vec3i_t) {g_camera.x0, g_camera.y0, 0};
+    for (size_t isurf = 0; isurf < shape->n_faces; ++isurf) {
+        face_t* face = &shape->faces[isurf];
+        if (shape->is_two_sided) {
+            face->is_culled = false;
+            continue;
+        }
+        vec3i_t view = (vec3i_t) {0, 0, 1};
+        if (g_use_perspective)
+            view = vec_vec3i_sub(&face->points[0], (vec3i_t*) &eye);
+        // in 64 bits since normals grow with the square of the mesh's size
+        const long long cosine = (long long) face->normal.x*view.x +
+                                 (long long) face->normal.y*view.y +
+                                 (long long) face->normal.z*view.z;
+        face->is_culled = cosine >= 0;
+    }
+}
+
+/* depth at index `ind` of the depth buffer, INT_MAX if it's not been written this frame */
+static inline int render__z_at(size_t ind) {
+    return (g_z_generations[ind] == g_z_generation) ? g_z_buffer[ind] : INT_MAX;
+}
+
+/* writes depth `z` of face `face` at index `ind` of the depth buffer in the current frame */
+static inline void render__z_set(size_t ind, int z, const face_t* face) {
+    g_z_buffer[ind] = z;
+    g_z_generations[ind] = g_z_generation;
+    if (g_face_ids != NULL)
+        g_face_ids[ind] = face;
+}
+
+/* face drawn at index `ind` of the screen buffer, NULL if none */
+static inline const face_t* render__face_id_at(size_t ind) {
+    return (g_z_generations[ind] == g_z_generation) ? g_face_ids[ind] : NULL;
 }
 
 static void render_reset_zbuffer() {
-    for (size_t i = 0; i < g_buffer_size; ++i)
-        g_z_buffer[i] = INT_MAX;
+    // the tags are only cleared when the generation wraps around, so that no
+    // stale entry is mistaken for one of the new generation
+    if (++g_z_generation == 0) {
+        memset(g_z_generations, 0, sizeof(unsigned char) * g_buffer_size);
+        g_z_generation = 1;
+    }
+    for (size_t i = 0; i < g_n_depth_blocks; ++i)
+        g_depth_blocks[i] = (depth_block_t) {INT_MAX, INT_MAX, false};
+}
+
+static inline depth_block_t* render__depth_block(int row, int col) {
+    return &g_depth_blocks[(row/RENDER_BLOCK_SIZE)*g_depth_blocks_per_row + col/RENDER_BLOCK_SIZE];
+}
+
+/* records that the pixel at (row, col) of the depth buffer went from depth `z_old` to `z` */
+static inline void render__depth_written(int row, int col, int z_old, int z) {
+    depth_block_t* block = render__depth_block(row, col);
+    block->z_min = UT_MIN(block->z_min, z);
+    block->is_max_stale |= z_old == block->z_max;
+}
+
+/* furthest depth in the block of the depth buffer that contains (row, col) */
+static int render__depth_block_max(int row, int col) {
+    depth_block_t* block = render__depth_block(row, col);
+    if (!block->is_max_stale)
+        return block->z_max;
+    const int row0 = row - row%RENDER_BLOCK_SIZE;
+    const int col0 = col - col%RENDER_BLOCK_SIZE;
+    const int row1 = UT_MIN(row0 + RENDER_BLOCK_SIZE, g_rows);
+    const int col1 = UT_MIN(col0 + RENDER_BLOCK_SIZE, g_cols);
+    block->z_max = INT_MIN;
+    for (int r = row0; r < row1; ++r)
+        for (int c = col0; c < col1; ++c)
+            block->z_max = UT_MAX(block->z_max, render__z_at(r*g_cols + c));
+    block->is_max_stale = false;
+    return block->z_max;
+}
+
+/* sets up a tile that covers rows [row0, row1) and columns [col0, col1) of the screen */
+static void render__set_tile(tile_t* tile, int row0, int row1, int col0, int col1) {
+    int xmin, ymin, xmax, ymax;
+    screen_get_bounds(&xmin, &ymin, &xmax, &ymax);
+    tile->row0 = row0;
+    tile->col0 = col0;
+    tile->row1 = row1;
+    tile->col1 = col1;
+    tile->xmin = tile->col0 - g_cols/2;
+    tile->xmax = tile->col1 - 1 - g_cols/2;
+    // rows are scaled so find which y-coordinates they span
+    tile->ymin = ymax + 1;
+    tile->ymax = ymin - 1;
+    for (int y = ymin; y <= ymax; ++y) {
+        const int row = screen_y2row(y);
+        if ((tile->row0 <= row) && (row < tile->row1)) {
+            tile->ymin = UT_MIN(tile->ymin, y);
+            tile->ymax = UT_MAX(tile->ymax, y);
+        }
+    }
+}
+
+/**
+ * @brief Splits the screen into tiles, one per thread's unit of work. A single
+ *        thread draws the whole screen as one tile, unless it supersamples.
+ */
+static void render__init_tiles() {
+    // the faces binned into small tiles are also the ones edge cells are sampled against
+    const bool is_tiled = (g_render_threads > 1) || (g_render_supersamples > 0);
+    g_tile_rows = (is_tiled) ? RENDER_TILE_ROWS : g_rows;
+    g_tile_cols = (is_tiled) ? RENDER_TILE_COLS : g_cols;
+    g_tiles_per_row = (g_cols + g_tile_cols - 1)/g_tile_cols;
+    g_n_tiles = g_tiles_per_row*((g_rows + g_tile_rows - 1)/g_tile_rows);
+    g_tiles = calloc(g_n_tiles, sizeof(tile_t));
+    for (size_t i = 0; i < g_n_tiles; ++i) {
+        const int row0 = (i/g_tiles_per_row)*g_tile_rows;
+        const int col0 = (i%g_tiles_per_row)*g_tile_cols;
+        render__set_tile(&g_tiles[i], row0, UT_MIN(row0 + g_tile_rows, g_rows),
+                         col0, UT_MIN(col0 + g_tile_cols, g_cols));
+    }
+    // rays are cast a whole row at a time
+    render__set_tile(&g_screen_tile, 0, g_rows, 0, g_cols);
+}
+
+/* whether the pixel at index `ind` of the screen buffer belongs to a tile */
+static inline bool render__tile_contains(tile_t* tile, size_t ind) {
+    const int row = ind/g_cols;
+    const int col = ind - row*g_cols;
+    return (tile->row0 <= row) && (row < tile->row1) &&
+           (tile->col0 <= col) && (col < tile->col1);
+}
+
+static void render__draw_item(size_t i);
+
+/* draws tiles of the current shapes until there are none left */
+static void render__draw_items() {
+    size_t i;
+    while ((i = __atomic_fetch_add(&g_pool_next_item, 1, __ATOMIC_RELAXED)) < g_pool_n_items)
+        render__draw_item(i);
+}
+
+static void* render__worker(void* arg) {
+    unsigned frame = 0;
+    pthread_mutex_lock(&g_pool_mutex);
+    while (true) {
+        while ((g_pool_frame == frame) && !g_pool_quit)
+            pthread_cond_wait(&g_pool_start, &g_pool_mutex);
+        if (g_pool_quit)
+            break;
+        frame = g_pool_frame;
+        pthread_mutex_unlock(&g_pool_mutex);
+        render__draw_items();
+        pthread_mutex_lock(&g_pool_mutex);
+        if (--g_pool_busy == 0)
+            pthread_cond_signal(&g_pool_done);
+    }
+    pthread_mutex_unlock(&g_pool_mutex);
+    return NULL;
 }
 
 //------------------------------------------------------------------------------------
@@ -130,22 +782,234 @@ void render_use_reflectance() {
     g_use_reflectance = true;
 }
 
+void render_use_rasterizer() {
+    g_use_rasterizer = true;
+}
+
+void render_use_fixed_point() {
+    g_use_fixed_point = true;
+}
+
+void render_use_supersampling(unsigned n_samples) {
+    // edge cells are sampled with floating point maths
+#ifndef INTEGER_ONLY
+    // the side of the grid of samples
+    const unsigned side = round(sqrt(n_samples));
+    g_render_supersamples = UT_CLIP(side, RENDER_MIN_SUPERSAMPLES, RENDER_MAX_SUPERSAMPLES);
+    g_render_supersamples *= g_render_supersamples;
+#endif
+}
+
+void render_use_threads(unsigned n_threads) {
+    g_render_threads = (n_threads < 1) ? 1 : n_threads;
+}
+
 void render_init() {
     // initialize screen (pixel) buffer
     screen_init();
     // z buffer that records the depth of each pixel
     g_z_buffer = malloc(sizeof(int) * g_buffer_size);
+    // all of it is stale until it's written
+    g_z_generations = calloc(g_buffer_size, sizeof(unsigned char));
+    if (g_render_supersamples > 0) {
+        g_face_ids = malloc(sizeof(face_t*) * g_buffer_size);
+        g_edge_cells = malloc(sizeof(size_t) * g_buffer_size);
+    }
+    // and its coarse version, one entry per block of pixels
+    g_depth_blocks_per_row = (g_cols + RENDER_BLOCK_SIZE - 1)/RENDER_BLOCK_SIZE;
+    g_n_depth_blocks = g_depth_blocks_per_row*((g_rows + RENDER_BLOCK_SIZE - 1)/RENDER_BLOCK_SIZE);
+    g_depth_blocks = malloc(sizeof(depth_block_t) * g_n_depth_blocks);
     render_reset_zbuffer();
-    g_plane_test = obj_plane_new();
-    g_surf_points = malloc(sizeof(vec3i_t*) * 4);
-    g_ray_test = obj_ray_new();
-    obj_ray_set(g_ray_test, 0, 0, 0, 0, 0, 0);
     // reflection colors from brightest to darkest
     strncpy(g_colors_refl, "#OT&=@$x%><)(nc+:;qy\"/?|+.,-v^!`", 32);
+    render__init_refl_lut();
+    render__init_tiles();
+    render__set_view_proj();
+    // the calling thread draws tiles too
+    g_pool_threads = malloc(sizeof(pthread_t) * g_render_threads);
+    for (unsigned i = 1; i < g_render_threads; ++i)
+        pthread_create(&g_pool_threads[i], NULL, render__worker, NULL);
 }
 
 
-void render_write_shape(mesh_t* shape) {
+/* end of the range of faces[first, n) of type `type`, the faces being grouped by type in order */
+static inline size_t render__type_end(const mesh_t* shape, const size_t* faces, size_t first, size_t n, int type) {
+    while (first < n) {
+        const size_t mid = first + (n - first)/2;
+        if (shape->faces[faces[mid]].type <= type)
+            first = mid + 1;
+        else
+            n = mid;
+    }
+    return first;
+}
+
+/**
+ * @brief Tests faces of one type of a shape against a run of `OBJ_RUN_LENGTH`
+ *        pixels from (x, y) and draws the ones they hit. It's inlined for each
+ *        type so that the intersection tests are picked once, not per face.
+ *
+ * @param shape     Pointer to the shape to render
+ * @param tile      Tile to draw
+ * @param x         x-coordinate of the first pixel of the run
+ * @param y         y-coordinate of the pixels
+ * @param ind_first Index of the first pixel of the run in the buffer
+ * @param z_max     Furthest depth drawn under the run
+ * @param faces     Indexes of the faces to test, all of type `type`
+ * @param n_faces   Number of faces to test
+ * @param type      Connection type of the faces
+ */
+static inline void render__raycast_run(mesh_t* shape, tile_t* tile, int x, int y, size_t ind_first, int z_max,
+                                       const size_t* faces, size_t n_faces, int type) {
+    const int margin = (g_use_fixed_point) ? 0 : RENDER_RECT_MARGIN;
+    int z_hits[OBJ_RUN_LENGTH];
+    for (size_t i = 0; i < n_faces; ++i) {
+        face_t* face = &shape->faces[faces[i]];
+        if ((x + OBJ_RUN_LENGTH - 1 < face->xmin - margin) || (x > face->xmax + margin))
+            continue;
+        // the face's plane is closest at either end of the run - skip the
+        // intersection tests if it's behind everything there
+        if (UT_MIN(render__face_z_at_xy(face, x, y),
+                   render__face_z_at_xy(face, x + OBJ_RUN_LENGTH - 1, y)) >= z_max)
+            continue;
+        unsigned hits = (g_use_fixed_point) ? render__face_covers_run(face, x, y, z_hits, type) :
+                                              render__ray_hits_face_run(face, x, y, z_hits, type);
+        // drop the pixels of the run that lie outside of the face's rectangle
+        // so that runs agree with the per-pixel tests
+        const int j_first = UT_MAX(face->xmin - margin - x, 0);
+        const int j_last = UT_MIN(face->xmax + margin - x, OBJ_RUN_LENGTH - 1);
+        hits &= ((2u << j_last) - 1) & ~((1u << j_first) - 1);
+        while (hits != 0) {
+            const int j = __builtin_ctz(hits);
+            hits &= hits - 1;
+            const size_t buffer_ind = ind_first + j;
+            if (!render__tile_contains(tile, buffer_ind))
+                continue;
+            const int z_old = render__z_at(buffer_ind);
+            if (z_hits[j] < z_old) {
+                render__depth_written(buffer_ind/g_cols, buffer_ind%g_cols, z_old, z_hits[j]);
+                render__z_set(buffer_ind, z_hits[j], face);
+                screen_write_pixel(x + j, -y, face->shade);
+            }
+        }
+    } /* for surfaces */
+}
+
+/**
+ * @brief Casts a ray at faces of one type of a shape into the pixel (x, y). It's
+ *        inlined for each type like `render__raycast_run`.
+ *
+ * @param shape      Pointer to the shape to render
+ * @param ray        Ray from the camera, its end is set for each face
+ * @param x          x-coordinate of the pixel
+ * @param y          y-coordinate of the pixel
+ * @param buffer_ind Index of the pixel in the buffer
+ * @param faces      Indexes of the faces to test, all of type `type`
+ * @param n_faces    Number of faces to test
+ * @param type       Connection type of the faces
+ */
+static inline void render__raycast_pixel(mesh_t* shape, ray_t* ray, int x, int y, size_t buffer_ind,
+                                         const size_t* faces, size_t n_faces, int type) {
+    const int margin = (g_use_fixed_point) ? 0 : RENDER_RECT_MARGIN;
+    for (size_t i = 0; i < n_faces; ++i) {
+        // the face's plane and edges have been set up after the mesh moved
+        face_t* face = &shape->faces[faces[i]];
+        if ((x < face->xmin - margin) || (x > face->xmax + margin))
+            continue;
+        // we keep the z to find the closest one to the origin and we draw
+        // its x and y at the z the ray hits the current surface
+        int z_hit = render__face_z_at_xy(face, x, y);
+        obj_ray_send(ray, x, y, z_hit);
+        // the depth test is cheaper so it goes first
+        const int z_old = render__z_at(buffer_ind);
+        bool is_hit = z_hit < z_old;
+        if (is_hit && g_use_fixed_point) {
+            int e[5];
+            for (int k = 0; k < 5; ++k)
+                e[k] = render__edge_at(&face->edges[k], x, y);
+            is_hit = render__face_covers(face, e, type);
+        } else if (is_hit) {
+            is_hit = render__ray_hits_face(ray, face, type);
+        }
+        if (is_hit) {
+            render__depth_written(buffer_ind/g_cols, buffer_ind%g_cols, z_old, z_hit);
+            render__z_set(buffer_ind, z_hit, face);
+            screen_write_pixel(x, -y, face->shade);
+        }
+    } /* for surfaces */
+}
+
+/**
+ * @brief Casts rays at a shape into the pixels (x_first, y) to (x_last, y) that
+ *        land in a tile of the screen
+ *
+ * @param shape   Pointer to the shape to render
+ * @param tile    Tile to draw
+ * @param y       y-coordinate of the pixels
+ * @param x_first x-coordinate of the first pixel
+ * @param x_last  x-coordinate of the last pixel
+ */
+static void render__raycast_span(mesh_t* shape, tile_t* tile, int y, int x_first, int x_last) {
+    if (x_first > x_last)
+        return;
+    // faces that may be hit on the current row
+    size_t* row_faces = tile->faces;
+    const int margin = (g_use_fixed_point) ? 0 : RENDER_RECT_MARGIN;
+    // only test faces whose rectangle overlaps the row
+    const size_t n_row_faces = obj_mesh_faces_in_rect(shape, x_first - margin, y - margin,
+                                                      x_last + margin, y + margin, row_faces);
+    if (n_row_faces == 0)
+        return;
+    // they're grouped by type in the order of the types, faces of type t are
+    // row_faces[type_first[t], type_first[t + 1]) and each group is cast at
+    // with its own tests - in the order they're found, as pixels are drawn by
+    // the first of the faces hit at the same depth
+    size_t type_first[NUM_CONNECTIONS + 1] = {0};
+    for (int type = 0; type < NUM_CONNECTIONS; ++type)
+        type_first[type + 1] = render__type_end(shape, row_faces, type_first[type], n_row_faces, type);
+    vec3i_t ray_origin = (vec3i_t) {g_camera.x0, g_camera.y0, g_camera.focal_length};
+    vec3i_t ray_end;
+    ray_t ray = {&ray_origin, &ray_end};
+    int x = x_first;
+    // runs of pixels that land on consecutive indexes of the buffer are
+    // tested against each face at once - vectorized if possible
+    for (; x + OBJ_RUN_LENGTH - 1 <= x_last; x += OBJ_RUN_LENGTH) {
+        const size_t ind_first = screen_xy2ind(x, -y);
+        if ((ind_first == 0) || (screen_xy2ind(x + OBJ_RUN_LENGTH - 1, -y) != ind_first + OBJ_RUN_LENGTH - 1))
+            break;
+        // furthest depth drawn under the run if it's all in this tile, the depth
+        // blocks of other tiles may be being written by other threads
+        const size_t ind_last = ind_first + OBJ_RUN_LENGTH - 1;
+        int z_max = INT_MAX;
+        if (render__tile_contains(tile, ind_first) && render__tile_contains(tile, ind_last))
+            z_max = UT_MAX(render__depth_block_max(ind_first/g_cols, ind_first%g_cols),
+                           render__depth_block_max(ind_last/g_cols, ind_last%g_cols));
+#define X(a, b, c, d) render__raycast_run(shape, tile, x, y, ind_first, z_max, &row_faces[type_first[b]], \
+                                          type_first[b + 1] - type_first[b], b);
+        CONN_TABLE
+#undef X
+    } /* for runs of x */
+    for (; x <= x_last; ++x) {
+        // -y to avoid drawing inverted images
+        const size_t buffer_ind = screen_xy2ind(x, -y);
+        // pixels off the screen land on index 0 - its own pixel is never cast
+        if ((buffer_ind == 0) || !render__tile_contains(tile, buffer_ind))
+            continue;
+#define X(a, b, c, d) render__raycast_pixel(shape, &ray, x, y, buffer_ind, &row_faces[type_first[b]], \
+                                            type_first[b + 1] - type_first[b], b);
+        CONN_TABLE
+#undef X
+    } /* for x */
+}
+
+/**
+ * @brief Casts rays at a shape into the pixels of a tile of the screen. Rays are
+ *        parallel to the z axis - with perspective, shapes are rasterized.
+ *
+ * @param shape Pointer to the shape to render
+ * @param tile  Tile to draw
+ */
+static void render__raycast(mesh_t* shape, tile_t* tile) {
 /*
  * This function renders the given cube by the basic ray tracing principle.
  *
@@ -181,77 +1045,545 @@ void render_write_shape(mesh_t* shape) {
  *                                           \
  *                                            V
  */
-    // whether we want to use the perspective transform or not
-    vec3i_t ray_origin = (vec3i_t) {g_camera.x0, g_camera.y0, g_camera.focal_length};
-    vec_vec3i_copy(g_ray_test->orig, &ray_origin);
-    // screen boundaries
-    int xmin, xmax, ymin, ymax;
-    if (g_use_perspective) {
-        // clip rendering area to bounding box
-        xmin = UT_MIN(shape->bounding_box.x0, shape->bounding_box.x1);
-        ymin = UT_MIN(shape->bounding_box.y0, shape->bounding_box.y1);
-        xmax = UT_MAX(shape->bounding_box.x0, shape->bounding_box.x1);
-        ymax = UT_MAX(shape->bounding_box.y0, shape->bounding_box.y1);
-    } else {
-        // clip rendering area to screen clip to rows and columns
-        xmin = UT_MAX(-g_cols/2+1, shape->bounding_box.x0);
-        ymin = UT_MAX(-g_rows, shape->bounding_box.y0);
-        xmax = UT_MIN(g_cols/2, shape->bounding_box.x1);
-        ymax = UT_MIN(g_rows+1, shape->bounding_box.y1);
-    }
-    // downscale by subsampling if we use perspective
-    unsigned step = (g_use_perspective) ?
-        UT_MIN(abs(shape->bounding_box.z0), abs(shape->bounding_box.z1))/g_camera.focal_length :
-        1;
-    step = (step < 1) ? 1 : step;
-
-    for (int y = ymin;  y <= ymax; y += step) {
-        for (int x = xmin; x <= xmax; x += step) {
-            // -y to avoid drawing inverted images
-            size_t buffer_ind = screen_xy2ind(x, -y);
-            // the final pixel and color to render
-            vec3i_t rendered_point = (vec3i_t) {x, -y, g_z_buffer[buffer_ind]};
-            for (size_t isurf = 0; isurf < shape->n_faces; ++isurf) {
-                // unpack surface info, hence define surface from shape->vertices
-                const size_t ipoint0 = shape->connections[isurf][0];
-                const size_t ipoint1 = shape->connections[isurf][1];
-                const size_t ipoint2 = shape->connections[isurf][2];
-                const size_t ipoint3 = shape->connections[isurf][3];
-                const int connection_type = shape->connections[isurf][4];
-                const color_t surf_color = shape->connections[isurf][5];
-                g_surf_points[0] = shape->vertices[ipoint0];
-                g_surf_points[1] = shape->vertices[ipoint1];
-                g_surf_points[2] = shape->vertices[ipoint2];
-                g_surf_points[3] = shape->vertices[ipoint3];
-                
-                // find intersections of ray and surface and set colour accordingly
-                obj_plane_set(g_plane_test, g_surf_points[0], g_surf_points[1], g_surf_points[2]);
-                // we keep the z to find the closest one to the origin and we draw
-                // its x and y at the z the ray hits the current surface
-                int z_hit = plane_z_at_xy(g_plane_test, x, y);
-                obj_ray_send(g_ray_test, x, y, z_hit);
-                vec3i_t persp_point; 
-                // if we use perspective, we index the depth buffer at the (x,y)
-                // of the projected point, not the original one (`persp_point`)
-                if (g_use_perspective) {
-                    persp_point = (vec3i_t) {x, -y, z_hit};
-                    persp_point = render__persp_transform(&persp_point);
-                    buffer_ind = screen_xy2ind(persp_point.x, persp_point.y);
+    // clip rendering area to screen clip to rows and columns
+    const int xmin = UT_MAX(-g_cols/2+1, shape->bounding_box.x0);
+    const int ymin = UT_MAX(-g_rows, shape->bounding_box.y0);
+    const int xmax = UT_MIN(g_cols/2, shape->bounding_box.x1);
+    const int ymax = UT_MIN(g_rows+1, shape->bounding_box.y1);
+    // x = g_cols/2 is past the last column if there's an even number of them
+    // and wraps around to the first column of the next row
+    const int x_wrap = g_cols - g_cols/2;
+
+    for (int y = ymin;  y <= ymax; ++y) {
+        // a row of pixels is drawn on a row of the screen - those of rows off
+        // the screen land on index 0 or past the buffer and aren't drawn
+        const int row = screen_y2row(-y);
+        if ((row < 0) || (row >= g_rows))
+            continue;
+        // only the columns of the tile are cast
+        if ((tile->row0 <= row) && (row < tile->row1))
+            render__raycast_span(shape, tile, y, UT_MAX(xmin, tile->xmin), UT_MIN(xmax, tile->xmax));
+        // the pixel that wraps around belongs to the tile of the next row's first column
+        if ((tile->col0 == 0) && (tile->row0 <= row + 1) && (row + 1 < tile->row1) && (x_wrap <= xmax))
+            render__raycast_span(shape, tile, y, x_wrap, x_wrap);
+    } /* for y */
+}
+
+/**
+ * @brief Fills a triangle, given in screen coordinates, into the screen and depth
+ *        buffers. Only the pixels covered by the triangle are visited. Its edge
+ *        functions (and fixed-point depth) are set up once and then stepped
+ *        from pixel to pixel.
+ *
+ * @param a     First triangle vertex (screen x, y and depth z)
+ * @param b     Second triangle vertex
+ * @param c     Third triangle vertex
+ * @param rface Face the triangle belongs to - its depth in screen coordinates
+ *              is interpolated
+ * @param tile  Tile to clip the triangle to
+ */
+static void render__rasterize_triangle(vec3i_t* a, vec3i_t* b, vec3i_t* c, raster_face_t* rface, tile_t* tile) {
+    edge_t edges[3];
+    obj_edge_set(&edges[0], a, b);
+    obj_edge_set(&edges[1], b, c);
+    obj_edge_set(&edges[2], c, a);
+    // twice the signed area - its sign is the winding of the triangle on the screen
+    const int area = render__edge_at(&edges[0], c->x, c->y);
+    if (area == 0)
+        return;
+    // flip the edges of cw triangles so that they're non-negative inside
+    for (int k = 0; (area < 0) && (k < 3); ++k)
+        edges[k] = (edge_t) {-edges[k].a, -edges[k].b, -edges[k].c};
+    // clip the bounding rectangle of the triangle to the tile
+    const int xmin = UT_MAX(tile->xmin, UT_MIN(UT_MIN(a->x, b->x), c->x));
+    const int ymin = UT_MAX(tile->ymin, UT_MIN(UT_MIN(a->y, b->y), c->y));
+    const int xmax = UT_MIN(tile->xmax, UT_MAX(UT_MAX(a->x, b->x), c->x));
+    const int ymax = UT_MIN(tile->ymax, UT_MAX(UT_MAX(a->y, b->y), c->y));
+    // the depth of the pixels inside the triangle is between the depths of its
+    // vertices - one less in case it's rounded down
+    const int z_min = UT_MIN(UT_MIN(a->z, b->z), c->z) - 1;
+    // edge functions and depth at the start of the current row
+    int e_row[3];
+    for (int k = 0; k < 3; ++k)
+        e_row[k] = render__edge_at(&edges[k], xmin, ymin);
+    int64_t z_row = render__depth_at(&rface->depth, xmin, ymin);
+
+    for (int y = ymin; y <= ymax; ++y) {
+        const int row = screen_y2row(y);
+        const size_t row_ind = row*g_cols + g_cols/2;
+        int x_last;
+        for (int x_first = xmin; x_first <= xmax; x_first = x_last + 1) {
+            // the pixels of the row in the current block
+            const int col_first = x_first + g_cols/2;
+            x_last = UT_MIN(xmax, x_first + RENDER_BLOCK_SIZE - 1 - col_first%RENDER_BLOCK_SIZE);
+            // skip them if they're all behind the block
+            if (z_min >= render__depth_block_max(row, col_first))
+                continue;
+            int e[3];
+            for (int k = 0; k < 3; ++k)
+                e[k] = e_row[k] + (x_first - xmin)*edges[k].a;
+            int64_t z_fixed = z_row + (x_first - xmin)*rface->depth.dzdx;
+            for (int x = x_first; x <= x_last; ++x) {
+                // inside (or on an edge) if (x, y) is on the same side of all edges,
+                // keeping the edges means the two halves of a rectangle don't leave a seam
+                if ((e[0] >= 0) && (e[1] >= 0) && (e[2] >= 0)) {
+                    const int z = (g_use_fixed_point || g_use_perspective) ? render__round_fixed(z_fixed) :
+                                                                             plane_z_at_xy(&rface->plane, x, y);
+                    const size_t buffer_ind = row_ind + x;
+                    const int z_old = render__z_at(buffer_ind);
+                    if (z < z_old) {
+                        render__depth_written(row, x + g_cols/2, z_old, z);
+                        render__z_set(buffer_ind, z, rface->face);
+                        g_screen_buffer[buffer_ind] = rface->color;
+                    }
                 }
-                if ((*func_table_intersection[connection_type])(g_ray_test, g_surf_points) &&
-                (z_hit < g_z_buffer[buffer_ind])) {
-                    color_t rendered_color = surf_color;
-                    // modern compilers (gcc >= 4.0, clang >= 3.0) know how to optimize this:
-                    if (g_use_reflectance)
-                        rendered_color = render__reflect(g_ray_test, g_plane_test, shape);
-                    if (g_use_perspective)
-                        rendered_point = persp_point;
-                    g_z_buffer[buffer_ind] = z_hit;
-                    screen_write_pixel(rendered_point.x, rendered_point.y, rendered_color);
+                for (int k = 0; k < 3; ++k)
+                    e[k] += edges[k].a;
+                z_fixed += rface->depth.dzdx;
+            }
+        }
+        for (int k = 0; k < 3; ++k)
+            e_row[k] += edges[k].b;
+        z_row += rface->depth.dzdy;
+    }
+}
+
+static void render__rasterize_tile(tile_t* tile) {
+    for (size_t i = 0; i < tile->n_faces; ++i) {
+        raster_face_t* rface = &g_raster_faces[tile->faces[i]];
+        // rectangles are split along their p0-p2 diagonal
+        for (int j = 1; j + 1 < rface->n_points; ++j)
+            render__rasterize_triangle(&rface->points[0], &rface->points[j], &rface->points[j + 1], rface, tile);
+    }
+}
+
+/* whether the current frame is rasterized rather than ray cast - rays are only
+ * cast without perspective, which is drawn per vertex */
+static inline bool render__use_raster() {
+    return g_use_rasterizer || g_use_perspective;
+}
+
+static void render__draw_item(size_t i) {
+    if (render__use_raster()) {
+        // the faces of all shapes are binned into the tile
+        render__rasterize_tile(&g_tiles[i]);
+    } else {
+        for (size_t j = 0; j < g_pool_n_shapes; ++j)
+            render__raycast(g_pool_shapes[j], &g_tiles[i]);
+    }
+}
+
+/**
+ * @brief Finds the polygon a face covers on the screen from its vertices after
+ *        the per-vertex stage. Faces inside of the view frustum keep the screen
+ *        coordinates of their vertices, those partly outside of it are clipped.
+ *
+ * @param[in]  conn     Connection of the face, i.e. indexes of its vertices
+ * @param[in]  n_points Number of vertices of the face
+ * @param[in]  vertices Vertices of the face's shape after the per-vertex stage
+ * @param[out] points   Points of the polygon, room for `RENDER_MAX_POINTS`
+ *
+ * @return Number of points of the polygon, less than 3 if it's not on the screen
+ */
+static int render__project_face(const conn_t* conn, int n_points, const raster_vertex_t* vertices, vec3i_t* points) {
+    const uint32_t* indexes = conn->indexes;
+    unsigned outcode_all = ~0u, outcode_any = 0;
+    for (int i = 0; i < n_points; ++i) {
+        outcode_all &= vertices[indexes[i]].outcode;
+        outcode_any |= vertices[indexes[i]].outcode;
+    }
+    // all vertices are outside of the same plane
+    if (outcode_all != 0)
+        return 0;
+    if (outcode_any == 0) {
+        for (int i = 0; i < n_points; ++i)
+            points[i] = vertices[indexes[i]].screen;
+        return n_points;
+    }
+    clip_t clipped[RENDER_MAX_POINTS];
+    for (int i = 0; i < n_points; ++i)
+        clipped[i] = vertices[indexes[i]].clip;
+    n_points = render__clip_polygon(clipped, n_points, outcode_any);
+    for (int i = 0; i < n_points; ++i)
+        points[i] = render__clip2screen(&clipped[i]);
+    return n_points;
+}
+
+/**
+ * @brief Runs the per-vertex stage on the vertices of a shape - they're
+ *        transformed to clip coordinates and projected - and sets up its faces
+ *        in screen space once per frame. Each face is then binned into the tiles
+ *        its bounding rectangle overlaps. The shapes of a frame are set up one
+ *        after the other into the same arrays, which must have room for all of them.
+ *
+ * @param shape       Pointer to the shape to rasterize
+ * @param vertex_base Index of the shape's first vertex in `g_proj_vertices`
+ * @param face_base   Index of the shape's first face in `g_raster_faces`
+ */
+static void render__setup_raster(mesh_t* shape, size_t vertex_base, size_t face_base) {
+    raster_vertex_t* proj_vertices = &g_proj_vertices[vertex_base];
+    for (size_t i = 0; i < shape->n_vertices; ++i) {
+        raster_vertex_t* vertex = &proj_vertices[i];
+        vertex->clip = render__world2clip(&shape->vertices[i]);
+        // without perspective every vertex lands on the plane of the screen
+        vertex->outcode = (g_use_perspective) ? render__outcode(&vertex->clip) : 0;
+        if (vertex->outcode == 0)
+            vertex->screen = render__clip2screen(&vertex->clip);
+    }
+
+    int screen_xmin, screen_ymin, screen_xmax, screen_ymax;
+    screen_get_bounds(&screen_xmin, &screen_ymin, &screen_xmax, &screen_ymax);
+    for (size_t isurf = 0; isurf < shape->n_faces; ++isurf) {
+        const conn_t* conn = &shape->connections[isurf];
+        face_t* face = &shape->faces[isurf];
+        if (face->is_culled)
+            continue;
+        raster_face_t* rface = &g_raster_faces[face_base + isurf];
+        rface->n_points = render__project_face(conn, (face->type == CONNECTION_RECT) ? 4 : 3,
+                                               proj_vertices, rface->points);
+        if (rface->n_points < 3)
+            continue;
+        if (g_use_perspective) {
+            // the depth is -RENDER_DEPTH_SCALE/z, from the face's plane in world coordinates
+            if (!render__set_persp_depth(face, &rface->depth))
+                continue;
+            for (int i = 0; i < rface->n_points; ++i)
+                rface->points[i].z = render__round_fixed(render__depth_at(&rface->depth, rface->points[i].x,
+                                                                          rface->points[i].y));
+        } else {
+            // the depth of the face is interpolated in screen space
+            rface->plane.normal = &rface->normal;
+            obj_plane_set(&rface->plane, &rface->points[0], &rface->points[1], &rface->points[2]);
+            if (rface->normal.z == 0)
+                continue;
+            if (g_use_fixed_point)
+                obj_plane_set_depth(&rface->plane, &rface->depth);
+            else
+                rface->depth = (plane_depth_t) {0, 0, 0};
+        }
+        rface->color = face->shade;
+        rface->face = face;
+
+        // bin the face into the tiles under its bounding rectangle
+        int xmin = INT_MAX, ymin = INT_MAX, xmax = INT_MIN, ymax = INT_MIN;
+        for (int i = 0; i < rface->n_points; ++i) {
+            xmin = UT_MIN(xmin, rface->points[i].x);
+            ymin = UT_MIN(ymin, rface->points[i].y);
+            xmax = UT_MAX(xmax, rface->points[i].x);
+            ymax = UT_MAX(ymax, rface->points[i].y);
+        }
+        xmin = UT_MAX(xmin, screen_xmin);
+        ymin = UT_MAX(ymin, screen_ymin);
+        xmax = UT_MIN(xmax, screen_xmax);
+        ymax = UT_MIN(ymax, screen_ymax);
+        if ((xmin > xmax) || (ymin > ymax))
+            continue;
+        rface->rect = (rect_t) {xmin, xmax, ymin, ymax};
+        const int tile_row0 = screen_y2row(ymin)/g_tile_rows;
+        const int tile_row1 = screen_y2row(ymax)/g_tile_rows;
+        const int tile_col0 = (xmin + g_cols/2)/g_tile_cols;
+        const int tile_col1 = (xmax + g_cols/2)/g_tile_cols;
+        for (int tile_row = tile_row0; tile_row <= tile_row1; ++tile_row) {
+            for (int tile_col = tile_col0; tile_col <= tile_col1; ++tile_col) {
+                tile_t* tile = &g_tiles[tile_row*g_tiles_per_row + tile_col];
+                tile->faces[tile->n_faces++] = face_base + isurf;
+            }
+        }
+    }
+}
+
+/* sets up the faces of shapes (see `render__setup_raster`) into arrays with room for all of them */
+static void render__setup_shapes(mesh_t** shapes, size_t n_shapes, size_t n_vertices, size_t n_faces) {
+    if (g_proj_capacity < n_vertices) {
+        g_proj_capacity = n_vertices;
+        g_proj_vertices = realloc(g_proj_vertices, sizeof(raster_vertex_t) * g_proj_capacity);
+    }
+    if (g_raster_capacity < n_faces) {
+        g_raster_capacity = n_faces;
+        g_raster_faces = realloc(g_raster_faces, sizeof(raster_face_t) * g_raster_capacity);
+    }
+    for (size_t i = 0; i < g_n_tiles; ++i)
+        g_tiles[i].n_faces = 0;
+    size_t vertex_base = 0, face_base = 0;
+    for (size_t i = 0; i < n_shapes; ++i) {
+        render__setup_raster(shapes[i], vertex_base, face_base);
+        vertex_base += shapes[i]->n_vertices;
+        face_base += shapes[i]->n_faces;
+    }
+}
+
+/* whether a face belongs to one of the shapes being drawn */
+static bool render__is_pool_face(const face_t* face) {
+    for (size_t i = 0; i < g_pool_n_shapes; ++i) {
+        const mesh_t* shape = g_pool_shapes[i];
+        if ((face >= shape->faces) && (face < shape->faces + shape->n_faces))
+            return true;
+    }
+    return false;
+}
+
+/* whether the point (x, y) is inside (or on an edge of) the convex polygon of a face */
+static bool render__polygon_covers(const raster_face_t* rface, float x, float y) {
+    bool has_pos = false, has_neg = false;
+    for (int i = 0; i < rface->n_points; ++i) {
+        const vec3i_t* p = &rface->points[i];
+        const vec3i_t* q = &rface->points[(i + 1)%rface->n_points];
+        const float cross = (float) (q->x - p->x)*(y - p->y) - (float) (q->y - p->y)*(x - p->x);
+        has_pos |= cross > 0;
+        has_neg |= cross < 0;
+    }
+    return !(has_pos && has_neg);
+}
+
+/* depth of a face at the point (x, y) in the units of the depth buffer */
+static float render__polygon_z_at(const raster_face_t* rface, float x, float y) {
+    if (g_use_fixed_point || g_use_perspective)
+        return (rface->depth.z0 + rface->depth.dzdx*(double) x + rface->depth.dzdy*(double) y) /
+               (1 << OBJ_FIXED_BITS);
+    const vec3i_t* n = rface->plane.normal;
+    return -((float) n->x*x + (float) n->y*y + rface->plane.offset)/n->z;
+}
+
+/* whether the cells at indexes `ind` and `ind_other` of the screen buffer are
+ * drawn from different faces that look different */
+static inline bool render__is_edge_between(size_t ind, size_t ind_other) {
+    return (g_screen_buffer[ind] != g_screen_buffer[ind_other]) &&
+           (render__face_id_at(ind) != render__face_id_at(ind_other));
+}
+
+/* whether a cell of the screen is on a visible edge between it and a neighbour */
+static bool render__is_edge_cell(int row, int col) {
+    const size_t ind = row*g_cols + col;
+    return ((row > 0) && render__is_edge_between(ind, ind - g_cols)) ||
+           ((row + 1 < g_rows) && render__is_edge_between(ind, ind + g_cols)) ||
+           ((col > 0) && render__is_edge_between(ind, ind - 1)) ||
+           ((col + 1 < g_cols) && render__is_edge_between(ind, ind + 1));
+}
+
+/**
+ * @brief Smooths the edges of the shapes just drawn. Each cell whose face
+ *        differs from that of a neighbour is sampled at a grid of points, the
+ *        nearest of the faces binned into its tile being hit by each, and is
+ *        given the glyph that most of the samples see (the current one on a tie).
+ *        Cells already drawn by other shapes stay where the samples are behind them.
+ *
+ * @param row0 First row of the area to smooth
+ * @param row1 Row after the last one
+ * @param col0 First column of the area to smooth
+ * @param col1 Column after the last one
+ */
+static void render__refine_edges(int row0, int row1, int col0, int col1) {
+    const int side = round(sqrt(g_render_supersamples));
+    // cells are smoothed in place, so they're found first
+    size_t n_edges = 0;
+    for (int row = row0; row < row1; ++row)
+        for (int col = col0; col < col1; ++col)
+            if (render__is_edge_cell(row, col))
+                g_edge_cells[n_edges++] = row*g_cols + col;
+
+    for (size_t i = 0; i < n_edges; ++i) {
+        const size_t ind = g_edge_cells[i];
+        const int row = ind/g_cols;
+        const int col = ind%g_cols;
+        const tile_t* tile = &g_tiles[(row/g_tile_rows)*g_tiles_per_row + col/g_tile_cols];
+        // what's seen where no face of these shapes is, and how far
+        const face_t* face = render__face_id_at(ind);
+        const bool is_behind = (face != NULL) && !render__is_pool_face(face);
+        const color_t behind = (is_behind) ? g_screen_buffer[ind] : ' ';
+        const float z_behind = (is_behind) ? render__z_at(ind) : INFINITY;
+        float ymin, ymax;
+        screen_row2y(row, &ymin, &ymax);
+        const float xmin = col - g_cols/2 - 0.5f;
+        // only the faces of the tile whose rectangle overlaps the cell are sampled
+        size_t n_cell_faces = 0;
+        for (size_t j = 0; j < tile->n_faces; ++j) {
+            const rect_t* rect = &g_raster_faces[tile->faces[j]].rect;
+            if ((rect->xmin <= xmin + 1) && (rect->xmax >= xmin) && (rect->ymin <= ymax) && (rect->ymax >= ymin))
+                g_cell_faces[n_cell_faces++] = tile->faces[j];
+        }
+        color_t samples[RENDER_MAX_SUPERSAMPLES*RENDER_MAX_SUPERSAMPLES];
+        int n_samples = 0;
+        for (int j = 0; j < side; ++j) {
+            const float y = ymin + (j + 0.5f)*(ymax - ymin)/side;
+            for (int k = 0; k < side; ++k) {
+                const float x = xmin + (k + 0.5f)/side;
+                color_t glyph = behind;
+                float z_min = z_behind;
+                for (size_t l = 0; l < n_cell_faces; ++l) {
+                    const raster_face_t* rface = &g_raster_faces[g_cell_faces[l]];
+                    if (!render__polygon_covers(rface, x, y))
+                        continue;
+                    const float z = render__polygon_z_at(rface, x, y);
+                    if (z < z_min) {
+                        z_min = z;
+                        glyph = rface->color;
+                    }
                 }
-            } /* for surfaces */
-        } /* for x */
-    } /* for y */
+                samples[n_samples++] = glyph;
+            }
+        }
+        // the glyph seen by most samples, if more than the current one
+        int n_best = 0;
+        for (int j = 0; j < n_samples; ++j)
+            if (samples[j] == g_screen_buffer[ind])
+                n_best++;
+        for (int j = 0; j < n_samples; ++j) {
+            int n = 0;
+            for (int k = 0; k < n_samples; ++k)
+                n += samples[k] == samples[j];
+            if (n > n_best) {
+                n_best = n;
+                g_screen_buffer[ind] = samples[j];
+            }
+        }
+    }
+}
+
+/* whether any of the screen rectangle a shape's bounding box projects to is on the screen */
+static bool render__is_on_screen(const mesh_t* shape) {
+    int xmin, ymin, xmax, ymax;
+    int screen_xmin, screen_ymin, screen_xmax, screen_ymax;
+    screen_get_bounds(&screen_xmin, &screen_ymin, &screen_xmax, &screen_ymax);
+    // with perspective, nothing behind the near plane is drawn
+    if (g_use_perspective && (shape->bounding_box.z1 < RENDER_NEAR))
+        return false;
+    // boxes that cross the near plane can't be projected so they're clipped per face
+    return !render__shape_screen_rect(shape, &xmin, &ymin, &xmax, &ymax) ||
+           ((xmax >= screen_xmin) && (xmin <= screen_xmax) && (ymax >= screen_ymin) && (ymin <= screen_ymax));
+}
+
+/**
+ * @brief Picks the level of detail of a shape from the size of the rectangle of
+ *        the screen its bounding box covers (see `obj_mesh_build_lods`)
+ *
+ * @param shape Pointer to the shape
+ *
+ * @return A pointer to the level to draw, moved to where the shape is
+ */
+static mesh_t* render__select_lod(mesh_t* shape) {
+    int xmin, ymin, xmax, ymax;
+    size_t level = 0;
+    if ((shape->n_lods > 0) && render__shape_screen_rect(shape, &xmin, &ymin, &xmax, &ymax)) {
+        const long long n_cells = (long long) (xmax - xmin + 1)*(screen_y2row(ymax) - screen_y2row(ymin) + 1);
+        while ((level < shape->n_lods) &&
+               ((long long) shape->lods[level]->n_faces >= RENDER_LOD_FACES_PER_CELL*n_cells))
+            level++;
+    }
+    // only the level that's drawn is moved, the shape itself included
+    return obj_mesh_lod(shape, level);
+}
+
+/* orders shapes by the nearest depth of their bounding box */
+static int render__compare_depth(const void* a, const void* b) {
+    const int z_a = (*(mesh_t* const*) a)->bounding_box.z0;
+    const int z_b = (*(mesh_t* const*) b)->bounding_box.z0;
+    return (z_a > z_b) - (z_a < z_b);
+}
+
+/**
+ * @brief Draws shapes into the screen and depth buffers in one pass - each tile
+ *        of the screen is drawn once, with all shapes in it
+ *
+ * @param shapes   Pointers to the shapes to draw, preferably nearest first so
+ *                 that the depth test rejects the pixels of the rest early
+ * @param n_shapes Number of shapes
+ */
+static void render__write_shapes(mesh_t** shapes, size_t n_shapes) {
+    size_t n_vertices = 0, n_faces = 0;
+    for (size_t i = 0; i < n_shapes; ++i) {
+        n_vertices += shapes[i]->n_vertices;
+        n_faces += shapes[i]->n_faces;
+    }
+    // lists of faces of tiles can hold all of them
+    if (g_bin_capacity < n_faces) {
+        g_bin_capacity = n_faces;
+        for (size_t i = 0; i < g_n_tiles; ++i)
+            g_tiles[i].faces = realloc(g_tiles[i].faces, sizeof(size_t) * g_bin_capacity);
+        g_screen_tile.faces = realloc(g_screen_tile.faces, sizeof(size_t) * g_bin_capacity);
+    }
+    // cells the shapes may cover
+    int row0 = INT_MAX, row1 = INT_MIN, col0 = INT_MAX, col1 = INT_MIN;
+    for (size_t i = 0; i < n_shapes; ++i) {
+        render__cull_faces(shapes[i]);
+        render__shade_faces(shapes[i]);
+        // the screen only draws (and empties) the cells the shapes may cover
+        int xmin, ymin, xmax, ymax;
+        if (!render__shape_screen_rect(shapes[i], &xmin, &ymin, &xmax, &ymax))
+            screen_get_bounds(&xmin, &ymin, &xmax, &ymax);
+        screen_mark_dirty(xmin, ymin, xmax, ymax);
+        row0 = UT_MIN(row0, screen_y2row(ymin));
+        row1 = UT_MAX(row1, screen_y2row(ymax));
+        col0 = UT_MIN(col0, xmin + g_cols/2);
+        col1 = UT_MAX(col1, xmax + g_cols/2);
+    }
+    // the ray caster can't bin faces - its intersections are rounded so a face
+    // can be hit outside of its projection - it picks the faces of each row
+    if (render__use_raster())
+        render__setup_shapes(shapes, n_shapes, n_vertices, n_faces);
+    g_pool_shapes = shapes;
+    g_pool_n_shapes = n_shapes;
+    if ((g_render_threads == 1) && !render__use_raster()) {
+        for (size_t i = 0; i < n_shapes; ++i)
+            render__raycast(shapes[i], &g_screen_tile);
+    } else if (g_render_threads == 1) {
+        for (size_t i = 0; i < g_n_tiles; ++i)
+            render__draw_item(i);
+    } else {
+        // wake up the workers and draw tiles alongside them
+        pthread_mutex_lock(&g_pool_mutex);
+        g_pool_next_item = 0;
+        g_pool_n_items = g_n_tiles;
+        g_pool_busy = g_render_threads - 1;
+        g_pool_frame++;
+        pthread_cond_broadcast(&g_pool_start);
+        pthread_mutex_unlock(&g_pool_mutex);
+        render__draw_items();
+        pthread_mutex_lock(&g_pool_mutex);
+        while (g_pool_busy > 0)
+            pthread_cond_wait(&g_pool_done, &g_pool_mutex);
+        pthread_mutex_unlock(&g_pool_mutex);
+    }
+    if (g_render_supersamples == 0)
+        return;
+    // edges are sampled against the binned faces, which the ray caster used to
+    // keep the faces of its rows
+    if (!render__use_raster())
+        render__setup_shapes(shapes, n_shapes, n_vertices, n_faces);
+    if (g_cell_faces_capacity < n_faces) {
+        g_cell_faces_capacity = n_faces;
+        g_cell_faces = realloc(g_cell_faces, sizeof(size_t) * g_cell_faces_capacity);
+    }
+    render__refine_edges(UT_MAX(row0, 0), UT_MIN(row1 + 1, g_rows), UT_MAX(col0, 0), UT_MIN(col1 + 1, g_cols));
+}
+
+/* makes room for `n_shapes` shapes in the queue of shapes to draw */
+static void render__reserve_queue(size_t n_shapes) {
+    if (g_queue_capacity < n_shapes) {
+        g_queue_capacity = n_shapes;
+        g_queue = realloc(g_queue, sizeof(mesh_t*) * g_queue_capacity);
+    }
+}
+
+void render_write_shape(mesh_t* shape) {
+    // nothing to draw if the shape is off the screen
+    if (render__is_on_screen(shape)) {
+        render__reserve_queue(1);
+        g_queue[0] = render__select_lod(shape);
+        render__write_shapes(g_queue, 1);
+    }
+}
+
+void render_write_scene(scene_t* scene) {
+    render__reserve_queue(scene->n_meshes);
+    // queue the meshes that are on the screen, nearest first
+    size_t n_queued = 0;
+    for (size_t i = 0; i < scene->n_meshes; ++i) {
+        if (render__is_on_screen(scene->meshes[i]))
+            g_queue[n_queued++] = render__select_lod(scene->meshes[i]);
+    }
+    qsort(g_queue, n_queued, sizeof(mesh_t*), render__compare_depth);
+    if (n_queued > 0)
+        render__write_shapes(g_queue, n_queued);
 }
 
 void render_flush() {
@@ -261,7 +1593,25 @@ void render_flush() {
 
 
 void render_end() {
+    pthread_mutex_lock(&g_pool_mutex);
+    g_pool_quit = true;
+    pthread_cond_broadcast(&g_pool_start);
+    pthread_mutex_unlock(&g_pool_mutex);
+    for (unsigned i = 1; i < g_render_threads; ++i)
+        pthread_join(g_pool_threads[i], NULL);
+    free(g_pool_threads);
+    for (size_t i = 0; i < g_n_tiles; ++i)
+        free(g_tiles[i].faces);
+    free(g_tiles);
+    free(g_screen_tile.faces);
     screen_end();
-    free(g_surf_points);
-    obj_plane_free(g_plane_test);
+    free(g_proj_vertices);
+    free(g_raster_faces);
+    free(g_depth_blocks);
+    free(g_z_buffer);
+    free(g_z_generations);
+    free(g_face_ids);
+    free(g_edge_cells);
+    free(g_cell_faces);
+    free(g_queue);
 }
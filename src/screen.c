@@ -10,6 +10,10 @@
 #include <string.h> // memset
 #include <stddef.h> // size_t 
 
+// size of the terminal when it can't be queried, e.g. when stdout isn't one
+#define SCREEN_DEFAULT_ROWS 24
+#define SCREEN_DEFAULT_COLS 80
+
 #ifndef _WIN32
 #define IOCTL_SIZE_INVALID 0
 //----------------------------------------------------------------------------------
@@ -17,6 +21,8 @@
 //----------------------------------------------------------------------------------
 #define SCREEN_CLEAR() printf("\033[H\033[J")
 #define SCREEN_GOTO_TOPLEFT() printf("\033[0;0H")
+// rows and columns start from 0, the terminal's from 1
+#define SCREEN_GOTO(row, col) printf("\033[%d;%dH", (row) + 1, (col) + 1)
 #define SCREEN_HIDE_CURSOR() printf("\e[?25l")
 #define SCREEN_SHOW_CURSOR() printf("\e[?25h")
 #else
@@ -43,6 +49,11 @@
     HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);         \
     SetConsoleCursorPosition(output, pos);                   \
 } while(0)
+#define SCREEN_GOTO(row, col) do {                           \
+    COORD pos = {(col), (row)};                              \
+    HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);         \
+    SetConsoleCursorPosition(output, pos);                   \
+} while(0)
 #define SCREEN_HIDE_CURSOR() ;
 #define SCREEN_SHOW_CURSOR() ;
 #endif
@@ -55,8 +66,24 @@ int g_cols;
 static float g_cols_over_rows;
 // screen resolution (pixels over pixels) 
 static float g_screen_res;
+#ifdef INTEGER_ONLY
+// rows per unit of y in fixed point, so that mapping y to rows needs no floating point maths
+static int64_t g_rows_per_y;
+#endif
 color_t* g_screen_buffer;
 size_t g_buffer_size;
+// range of screen coordinates that map inside the terminal
+static int g_xmin, g_xmax, g_ymin, g_ymax;
+
+// rows [row0, row1) and columns [col0, col1) of the terminal, empty if row0 >= row1
+typedef struct cell_rect {
+    int row0, row1;
+    int col0, col1;
+} cell_rect_t;
+// cells drawn in the current and in the previous frame - all others are empty
+// in the screen buffer and on the terminal
+static cell_rect_t g_dirty;
+static cell_rect_t g_dirty_prev;
 
 
 /**
@@ -70,12 +97,16 @@ size_t g_buffer_size;
  */
 static void draw__get_screen_info() {
     //// 1st way - ioctl call
-    struct winsize wsize;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &wsize);
+    struct winsize wsize = {0};
+    if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &wsize) != 0) || (wsize.ws_row == 0) || (wsize.ws_col == 0)) {
+        // its pixels are unknown as well, the resolution is found below
+        wsize = (struct winsize) {SCREEN_DEFAULT_ROWS, SCREEN_DEFAULT_COLS,
+                                  IOCTL_SIZE_INVALID, IOCTL_SIZE_INVALID};
+    }
     g_rows = wsize.ws_row;
     g_cols = wsize.ws_col;
     g_cols_over_rows = (float)g_cols/g_rows;
-    if ((wsize.ws_xpixel != IOCTL_SIZE_INVALID) || (wsize.ws_ypixel != IOCTL_SIZE_INVALID)) {
+    if ((wsize.ws_xpixel != IOCTL_SIZE_INVALID) && (wsize.ws_ypixel != IOCTL_SIZE_INVALID)) {
         g_screen_res = (float)wsize.ws_xpixel/wsize.ws_ypixel;
         return;
     }
@@ -103,20 +134,89 @@ static void draw__get_screen_info() {
     g_screen_res = 1920.0/1080.0;
 }
 
+/* smallest y whose row is at least `row`, found by bisection as rows are
+ * non-decreasing in y - the bound of the search if there's none */
+static int draw__first_y_of_row(int row) {
+    int lo = -(1 << 24), hi = 1 << 24;
+    while (lo < hi) {
+        const int mid = lo + (hi - lo)/2;
+        if (screen_y2row(mid) >= row)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/**
+ * @brief Finds the range of screen coordinates (x, y) whose pixels land inside
+ *        the terminal. Rows are scaled by the terminal's aspect ratio and
+ *        rounded, so we search `screen_y2row` rather than solving for y.
+ *        Writes to `g_xmin`, `g_xmax`, `g_ymin`, `g_ymax`.
+ */
+static void draw__update_bounds() {
+    g_xmin = -g_cols/2;
+    g_xmax = g_cols - 1 - g_cols/2;
+    g_ymin = draw__first_y_of_row(0);
+    g_ymax = draw__first_y_of_row(g_rows) - 1;
+}
+
+static inline bool draw__is_rect_empty(const cell_rect_t* rect) {
+    return (rect->row0 >= rect->row1) || (rect->col0 >= rect->col1);
+}
+
+/* smallest rectangle that contains two rectangles of cells */
+static cell_rect_t draw__rect_union(const cell_rect_t* a, const cell_rect_t* b) {
+    if (draw__is_rect_empty(a))
+        return *b;
+    if (draw__is_rect_empty(b))
+        return *a;
+    return (cell_rect_t) {UT_MIN(a->row0, b->row0), UT_MAX(a->row1, b->row1),
+                          UT_MIN(a->col0, b->col0), UT_MAX(a->col1, b->col1)};
+}
+
 void screen_init() {
     SCREEN_HIDE_CURSOR();
     SCREEN_CLEAR();
     // get terminal's size info
     draw__get_screen_info();
+#ifdef INTEGER_ONLY
+    g_rows_per_y = lround((1 << OBJ_FIXED_BITS)*g_screen_res/g_cols_over_rows);
+#endif
     g_buffer_size = g_rows*g_cols;
     g_screen_buffer = malloc(sizeof(color_t) * g_buffer_size);
+    memset(g_screen_buffer, ' ', sizeof(color_t) * g_buffer_size);
+    draw__update_bounds();
+    g_dirty = g_dirty_prev = (cell_rect_t) {0, 0, 0, 0};
+}
+
+int screen_y2row(int y) {
+    y += g_rows;
+#ifdef INTEGER_ONLY
+    return (y*g_rows_per_y + (1 << (OBJ_FIXED_BITS - 1))) >> OBJ_FIXED_BITS;
+#else
+    return round(y/(g_cols_over_rows/g_screen_res));
+#endif
+}
+
+void screen_row2y(int row, float* ymin, float* ymax) {
+    // rows are rounded, so each one spans half a row either side of its centre
+    const float row_height = g_cols_over_rows/g_screen_res;
+    *ymin = (row - 0.5)*row_height - g_rows;
+    *ymax = (row + 0.5)*row_height - g_rows;
+}
+
+void screen_get_bounds(int* xmin, int* ymin, int* xmax, int* ymax) {
+    *xmin = g_xmin;
+    *ymin = g_ymin;
+    *xmax = g_xmax;
+    *ymax = g_ymax;
 }
 
 size_t screen_xy2ind(int x, int y) {
     x += g_cols/2;
-    y += g_rows;
-    const int y_scaled = round(y/(g_cols_over_rows/g_screen_res));
-    const int ind_buffer = round(y_scaled*g_cols + x);
+    const int y_scaled = screen_y2row(y);
+    const int ind_buffer = y_scaled*g_cols + x;
     if ((ind_buffer >= g_buffer_size) || (ind_buffer < 0))
         return 0;
     return ind_buffer;
@@ -138,11 +238,26 @@ void screen_write_pixel(int x, int y, color_t c) {
     g_screen_buffer[ind_buffer] = c;
 }
 
+void screen_mark_dirty(int xmin, int ymin, int xmax, int ymax) {
+    cell_rect_t rect = (cell_rect_t) {UT_MAX(screen_y2row(ymin), 0), UT_MIN(screen_y2row(ymax) + 1, g_rows),
+                                      UT_MAX(xmin + g_cols/2, 0), UT_MIN(xmax + g_cols/2 + 1, g_cols)};
+    if (!draw__is_rect_empty(&rect))
+        g_dirty = draw__rect_union(&g_dirty, &rect);
+}
+
 void screen_flush() {
-    // render the screen buffer
-    for (size_t i = 0; i < g_buffer_size; ++i)
-        putchar(g_screen_buffer[i]);
-    memset(g_screen_buffer, ' ', sizeof(color_t) * g_buffer_size);
+    // render the cells that are drawn now or were drawn in the previous frame,
+    // which have to be erased, the rest of the terminal is already empty
+    const cell_rect_t rect = draw__rect_union(&g_dirty, &g_dirty_prev);
+    for (int row = rect.row0; row < rect.row1; ++row) {
+        SCREEN_GOTO(row, rect.col0);
+        fwrite(&g_screen_buffer[row*g_cols + rect.col0], sizeof(color_t), rect.col1 - rect.col0, stdout);
+    }
+    // and empty the cells that are drawn now
+    for (int row = g_dirty.row0; row < g_dirty.row1; ++row)
+        memset(&g_screen_buffer[row*g_cols + g_dirty.col0], ' ', sizeof(color_t) * (g_dirty.col1 - g_dirty.col0));
+    g_dirty_prev = g_dirty;
+    g_dirty = (cell_rect_t) {0, 0, 0, 0};
     SCREEN_GOTO_TOPLEFT();
 }
 
@@ -1,5 +1,6 @@
 #include "utils.h"
 #include <stdbool.h>
+#include <stdlib.h> // malloc, free
 
 bool ut_is_decimal(char* string) {
     bool ret = false;
@@ -13,3 +14,33 @@ bool ut_is_decimal(char* string) {
     }
     return ret;
 }
+
+ut_arena_t* ut_arena_new(size_t size) {
+    size = ut_arena_size(size);
+    ut_arena_t* new = malloc(sizeof(ut_arena_t) + size);
+    new->next = NULL;
+    new->size = size;
+    new->used = 0;
+    return new;
+}
+
+void* ut_arena_alloc(ut_arena_t* arena, size_t size) {
+    size = ut_arena_size(size);
+    // the first arena of the chain with room for it, a new one if there's none
+    while (arena->size - arena->used < size) {
+        if (arena->next == NULL)
+            arena->next = ut_arena_new(UT_MAX(2*arena->size, size));
+        arena = arena->next;
+    }
+    void* ret = &arena->data[arena->used];
+    arena->used += size;
+    return ret;
+}
+
+void ut_arena_free(ut_arena_t* arena) {
+    while (arena != NULL) {
+        ut_arena_t* next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
@@ -1,11 +1,17 @@
 #include "vector.h"
+#include "utils.h" // ut_div_round
 #include <stdbool.h> // true/false
 #include <stdlib.h> // malloc
-#include <math.h> // round
+#include <math.h> // round, sin
+#include <stdint.h> // int64_t
 
 // square root tolerance distance when comparing vectors 
 #define SQRT_TOL 1e-2
 
+// sines of the angles of a quarter turn in fixed point, the rest are mirrored
+static int g_sine_table[VEC_ANGLE_STEPS/4 + 1];
+static bool g_is_sine_table_set = false;
+
 
 //-----------------------------------------------------------------------------------
 //  Floating point vectors
@@ -213,3 +219,243 @@ void vec_vec3i_rotate(vec3i_t* src, float angle_x_rad, float angle_y_rad, float
     src->y = round(rotated.y);
     src->z = round(rotated.z);
 }
+
+//-----------------------------------------------------------------------------------
+// Fixed-point angles
+//-----------------------------------------------------------------------------------
+int vec_angle_from_rad(float angle_rad) {
+    // wrap around a full turn, negative angles included
+    return (int) lround(angle_rad*VEC_ANGLE_STEPS/(2*M_PI)) & (VEC_ANGLE_STEPS - 1);
+}
+
+int vec_sin_fixed(int angle) {
+    // the table is filled once, the only time sines are computed
+    if (!g_is_sine_table_set) {
+        for (int i = 0; i <= VEC_ANGLE_STEPS/4; ++i)
+            g_sine_table[i] = lround(sin(2*M_PI*i/VEC_ANGLE_STEPS)*(1 << VEC_FIXED_BITS));
+        g_is_sine_table_set = true;
+    }
+    angle &= VEC_ANGLE_STEPS - 1;
+    const int quarter = angle/(VEC_ANGLE_STEPS/4);
+    const int i = angle%(VEC_ANGLE_STEPS/4);
+    switch (quarter) {
+        case 0:  return g_sine_table[i];
+        case 1:  return g_sine_table[VEC_ANGLE_STEPS/4 - i];
+        case 2:  return -g_sine_table[i];
+        default: return -g_sine_table[VEC_ANGLE_STEPS/4 - i];
+    }
+}
+
+int vec_cos_fixed(int angle) {
+    return vec_sin_fixed(angle + VEC_ANGLE_STEPS/4);
+}
+
+void vec_vec3i_rotate_fixed(vec3i_t* src, int angle_x, int angle_y, int angle_z, int x0, int y0, int z0) {
+    const int64_t ca = vec_cos_fixed(angle_x), cb = vec_cos_fixed(angle_y), cc = vec_cos_fixed(angle_z);
+    const int64_t sa = vec_sin_fixed(angle_x), sb = vec_sin_fixed(angle_y), sc = vec_sin_fixed(angle_z);
+    // -(x0, y0, z0)
+    int64_t x = src->x - x0;
+    int64_t y = src->y - y0;
+    int64_t z = src->z - z0;
+    // same rotations as `vec_vec3i_rotate`, the coordinates are kept in fixed
+    // point from the first one on so that they're only rounded at the end
+    // Rx
+    int64_t tmp = ca*y - sa*z;
+    z = sa*y + ca*z;
+    y = tmp;
+    x *= 1 << VEC_FIXED_BITS;
+    // Ry
+    tmp = (cb*x + sb*z) >> VEC_FIXED_BITS;
+    z = (-sb*x + cb*z) >> VEC_FIXED_BITS;
+    x = tmp;
+    // Rz
+    tmp = (cc*x - sc*y) >> VEC_FIXED_BITS;
+    y = (sc*x + cc*y) >> VEC_FIXED_BITS;
+    x = tmp;
+    // +(x0, y0, z0)
+    const int64_t half = 1 << (VEC_FIXED_BITS - 1);
+    src->x = ((x + half) >> VEC_FIXED_BITS) + x0;
+    src->y = ((y + half) >> VEC_FIXED_BITS) + y0;
+    src->z = ((z + half) >> VEC_FIXED_BITS) + z0;
+}
+
+//-----------------------------------------------------------------------------------
+// 4x4 matrices
+//-----------------------------------------------------------------------------------
+mat4_t vec_mat4_identity() {
+    return (mat4_t) {{{1, 0, 0, 0},
+                      {0, 1, 0, 0},
+                      {0, 0, 1, 0},
+                      {0, 0, 0, 1}}};
+}
+
+mat4_t vec_mat4_mul(const mat4_t* left, const mat4_t* right) {
+    mat4_t product;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            product.m[i][j] = 0;
+            for (int k = 0; k < 4; ++k)
+                product.m[i][j] += left->m[i][k]*right->m[k][j];
+        }
+    }
+    return product;
+}
+
+vec4_t vec_mat4_apply(const mat4_t* mat, const vec3i_t* point) {
+    const float* r0 = mat->m[0];
+    const float* r1 = mat->m[1];
+    const float* r2 = mat->m[2];
+    const float* r3 = mat->m[3];
+    return (vec4_t) {r0[0]*point->x + r0[1]*point->y + r0[2]*point->z + r0[3],
+                     r1[0]*point->x + r1[1]*point->y + r1[2]*point->z + r1[3],
+                     r2[0]*point->x + r2[1]*point->y + r2[2]*point->z + r2[3],
+                     r3[0]*point->x + r3[1]*point->y + r3[2]*point->z + r3[3]};
+}
+
+mat4i_t vec_mat4_round(const mat4_t* mat) {
+    mat4i_t rounded;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            rounded.m[i][j] = lround(mat->m[i][j]);
+    return rounded;
+}
+
+vec4i_t vec_mat4i_apply(const mat4i_t* mat, const vec3i_t* point) {
+    const int* r0 = mat->m[0];
+    const int* r1 = mat->m[1];
+    const int* r2 = mat->m[2];
+    const int* r3 = mat->m[3];
+    return (vec4i_t) {r0[0]*point->x + r0[1]*point->y + r0[2]*point->z + r0[3],
+                      r1[0]*point->x + r1[1]*point->y + r1[2]*point->z + r1[3],
+                      r2[0]*point->x + r2[1]*point->y + r2[2]*point->z + r2[3],
+                      r3[0]*point->x + r3[1]*point->y + r3[2]*point->z + r3[3]};
+}
+
+mat4_t vec_mat4_rotation(float angle_x_rad, float angle_y_rad, float angle_z_rad, int x0, int y0, int z0) {
+    const float ca = cos(angle_x_rad), cb = cos(angle_y_rad), cc = cos(angle_z_rad);
+    const float sa = sin(angle_x_rad), sb = sin(angle_y_rad), sc = sin(angle_z_rad);
+    const mat4_t rotx = {{{1, 0,  0,   0},
+                          {0, ca, -sa, 0},
+                          {0, sa, ca,  0},
+                          {0, 0,  0,   1}}};
+    const mat4_t roty = {{{cb,  0, sb, 0},
+                          {0,   1, 0,  0},
+                          {-sb, 0, cb, 0},
+                          {0,   0, 0,  1}}};
+    const mat4_t rotz = {{{cc, -sc, 0, 0},
+                          {sc, cc,  0, 0},
+                          {0,  0,   1, 0},
+                          {0,  0,   0, 1}}};
+    const mat4_t rotyx = vec_mat4_mul(&roty, &rotx);
+    mat4_t rot = vec_mat4_mul(&rotz, &rotyx);
+    // the point is moved to the origin, rotated and moved back
+    const float p[3] = {x0, y0, z0};
+    for (int i = 0; i < 3; ++i)
+        rot.m[i][3] = p[i] - (rot.m[i][0]*p[0] + rot.m[i][1]*p[1] + rot.m[i][2]*p[2]);
+    return rot;
+}
+
+/* product of two 3x3 matrices in fixed point, rounded */
+static void vec__mat3_mul_fixed(const int64_t left[3][3], const int64_t right[3][3], int64_t product[3][3]) {
+    const int64_t half = 1 << (VEC_FIXED_BITS - 1);
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            product[i][j] = (left[i][0]*right[0][j] + left[i][1]*right[1][j] + left[i][2]*right[2][j] + half)
+                            >> VEC_FIXED_BITS;
+}
+
+mat4i_t vec_mat4i_rotation_fixed(int angle_x, int angle_y, int angle_z, int x0, int y0, int z0) {
+    const int64_t one = 1 << VEC_FIXED_BITS;
+    const int64_t ca = vec_cos_fixed(angle_x), cb = vec_cos_fixed(angle_y), cc = vec_cos_fixed(angle_z);
+    const int64_t sa = vec_sin_fixed(angle_x), sb = vec_sin_fixed(angle_y), sc = vec_sin_fixed(angle_z);
+    const int64_t rotx[3][3] = {{one, 0,  0  },
+                                {0,   ca, -sa},
+                                {0,   sa, ca }};
+    const int64_t roty[3][3] = {{cb,  0,   sb},
+                                {0,   one, 0 },
+                                {-sb, 0,   cb}};
+    const int64_t rotz[3][3] = {{cc, -sc, 0  },
+                                {sc, cc,  0  },
+                                {0,  0,   one}};
+    int64_t rotyx[3][3], rot[3][3];
+    vec__mat3_mul_fixed(roty, rotx, rotyx);
+    vec__mat3_mul_fixed(rotz, rotyx, rot);
+    // the point is moved to the origin, rotated and moved back
+    const int64_t p[3] = {x0, y0, z0};
+    mat4i_t ret = {{{0, 0, 0, 0},
+                    {0, 0, 0, 0},
+                    {0, 0, 0, 0},
+                    {0, 0, 0, one}}};
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j)
+            ret.m[i][j] = rot[i][j];
+        ret.m[i][3] = p[i]*one - (rot[i][0]*p[0] + rot[i][1]*p[1] + rot[i][2]*p[2]);
+    }
+    return ret;
+}
+
+mat4_t vec_mat4_from_quat(const quat_t* quat) {
+    const float w = quat->w, x = quat->x, y = quat->y, z = quat->z;
+    // dividing by the squared norm normalizes the quaternion without a square root
+    const float s = 2/(w*w + x*x + y*y + z*z);
+    return (mat4_t) {{{1 - s*(y*y + z*z), s*(x*y - w*z),     s*(x*z + w*y),     0},
+                      {s*(x*y + w*z),     1 - s*(x*x + z*z), s*(y*z - w*x),     0},
+                      {s*(x*z - w*y),     s*(y*z + w*x),     1 - s*(x*x + y*y), 0},
+                      {0,                 0,                 0,                 1}}};
+}
+
+mat4i_t vec_mat4i_from_quat_fixed(int w, int x, int y, int z) {
+    const int64_t one = 1 << VEC_FIXED_BITS;
+    const int64_t ww = (int64_t) w*w, xx = (int64_t) x*x, yy = (int64_t) y*y, zz = (int64_t) z*z;
+    const int64_t xy = (int64_t) x*y, xz = (int64_t) x*z, yz = (int64_t) y*z;
+    const int64_t wx = (int64_t) w*x, wy = (int64_t) w*y, wz = (int64_t) w*z;
+    // 2*one/norm^2, as in `vec_mat4_from_quat`, is applied to each product
+    const int64_t n = ww + xx + yy + zz;
+#define VEC_QUAT_FIXED(p) ((int) ut_div_round(2*one*(p), n))
+    return (mat4i_t) {{{one - VEC_QUAT_FIXED(yy + zz), VEC_QUAT_FIXED(xy - wz), VEC_QUAT_FIXED(xz + wy), 0},
+                       {VEC_QUAT_FIXED(xy + wz), one - VEC_QUAT_FIXED(xx + zz), VEC_QUAT_FIXED(yz - wx), 0},
+                       {VEC_QUAT_FIXED(xz - wy), VEC_QUAT_FIXED(yz + wx), one - VEC_QUAT_FIXED(xx + yy), 0},
+                       {0, 0, 0, one}}};
+#undef VEC_QUAT_FIXED
+}
+
+/* sine of half of a fixed-point angle, halfway between the sines of the steps
+ * around it for odd angles - close enough at this many steps */
+static inline int vec__sin_half_fixed(int angle) {
+    return (vec_sin_fixed(angle >> 1) + vec_sin_fixed((angle + 1) >> 1))/2;
+}
+
+quati_t vec_quati_from_angles_fixed(int angle_x, int angle_y, int angle_z) {
+    const int64_t one = 1 << VEC_FIXED_BITS;
+    const int64_t ca = vec__sin_half_fixed(angle_x + VEC_ANGLE_STEPS/2), sa = vec__sin_half_fixed(angle_x);
+    const int64_t cb = vec__sin_half_fixed(angle_y + VEC_ANGLE_STEPS/2), sb = vec__sin_half_fixed(angle_y);
+    const int64_t cc = vec__sin_half_fixed(angle_z + VEC_ANGLE_STEPS/2), sc = vec__sin_half_fixed(angle_z);
+    // qy*qx, then qz*(qy*qx), as the matrices are multiplied
+    const int64_t w = ut_div_round(cb*ca, one), x = ut_div_round(cb*sa, one);
+    const int64_t y = ut_div_round(sb*ca, one), z = -ut_div_round(sb*sa, one);
+    // from `VEC_FIXED_BITS` to 14 fractional bits
+    const int64_t to_14 = one << (VEC_FIXED_BITS - 14);
+    return (quati_t) {ut_div_round(cc*w - sc*z, to_14), ut_div_round(cc*x - sc*y, to_14),
+                      ut_div_round(cc*y + sc*x, to_14), ut_div_round(cc*z + sc*w, to_14)};
+}
+
+uint32_t vec_quat_turn_threshold(float angle_rad) {
+    // sin^2 of half of the angle with 32 fractional bits, short of 1 for half a turn
+    const double s = sin(UT_MIN(fabs(angle_rad), M_PI)/2);
+    return (uint32_t) UT_MIN(s*s*4294967296.0, 4294967295.0);
+}
+
+bool vec_quati_is_turned(const quati_t* a, const quati_t* b, uint32_t threshold) {
+    // w of conj(a)*b, the rotation from a to b scaled by the norms of both, is
+    // their dot product and sin^2 of half of its angle (|a|^2*|b|^2 - w^2)/(|a|^2*|b|^2)
+    const int64_t na = (int64_t) a->w*a->w + (int64_t) a->x*a->x + (int64_t) a->y*a->y + (int64_t) a->z*a->z;
+    const int64_t nb = (int64_t) b->w*b->w + (int64_t) b->x*b->x + (int64_t) b->y*b->y + (int64_t) b->z*b->z;
+    const int64_t w = (int64_t) a->w*b->w + (int64_t) a->x*b->x + (int64_t) a->y*b->y + (int64_t) a->z*b->z;
+    // the norms are below 2^32 and |w| is at most the root of their product,
+    // so the squares fit in 64 bits unsigned
+    const uint64_t norms = (uint64_t) na*(uint64_t) nb;
+    const uint64_t abs_w = (w < 0) ? -w : w;
+    // threshold*norms/2^32 without a 96-bit product
+    const uint64_t limit = threshold*(norms >> 32) + ((threshold*(norms & 0xffffffff)) >> 32);
+    return norms - abs_w*abs_w > limit;
+}